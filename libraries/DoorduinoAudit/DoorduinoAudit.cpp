@@ -0,0 +1,383 @@
+/*
+** Doorduino audit log
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+*/
+
+#include <inttypes.h>
+#include <EEPROM.h>
+#include <sha256.h> // https://github.com/Cathedrow/Cryptosuite
+#include <DoorduinoTrace.h>
+#include "WProgram.h"
+#include "DoorduinoAudit.h"
+
+#if AUDIT_SIZE<2*AUDIT_MAX_RECORD
+#error "STORE_SLOTS leaves no room for the audit log"
+#endif
+
+#if STORE_SLOTS>AUDIT_TIME
+#error "slot numbers would clash with the audit record tags"
+#endif
+
+static const prog_char str_audit[] PROGMEM = "/audit.php?up=";
+static const prog_char str_log[] PROGMEM = "&log=v";
+
+DoorduinoAudit::DoorduinoAudit(DoorduinoEnvironment *e, DoorduinoStore &store, DoorduinoClock &clock, PGM_P secret1) :
+  DoorduinoComponent(e),
+  _store(store),
+  _clock(clock)
+{
+  _secret1=secret1;
+  _state=AUDIT_IDLE;
+  _e_head=_e_count=0;
+  _dropped=0;
+  _uploaded=0;
+}
+
+/*
+** find the end of the log from the saved cursor, starts a new
+** log if the cursor or the records are not valid. A board that
+** keeps restarting offline would fill the log with markers, a
+** boot is only logged when a key was logged since the last one
+** and a bank only when the version is not the one in effect.
+** An old store layout that was kept has keys where the log
+** would go, the log stays empty then.
+*/
+void DoorduinoAudit::begin(void) {
+  int n=0;
+  bool boot=false;
+  uint16_t version;
+
+  if(_store.legacy()) {
+    _cursor=_head=AUDIT_START;
+    _stamped=true;
+    return;
+  }
+  _cursor=(EEPROM.read(AUDIT_CURSOR)<<8)|EEPROM.read(AUDIT_CURSOR+1);
+  _context=(EEPROM.read(AUDIT_CONTEXT)<<8)|EEPROM.read(AUDIT_CONTEXT+1);
+  _head=_cursor;
+  version=_context;
+
+  if( (_cursor>=AUDIT_START) && (_cursor<AUDIT_END) ) {
+    while( (n<AUDIT_SIZE) && (EEPROM.read(_head)!=AUDIT_FREE) ) {
+      byte type=EEPROM.read(_head);
+      int next=_skip(_head);
+
+      if(type==AUDIT_BANK) {
+        version=(EEPROM.read(_next(_head,1))<<8)|EEPROM.read(_next(_head,2));
+      } else if(type!=AUDIT_TIME) {
+        boot=(type==AUDIT_BOOT);
+      }
+      n+=(next-_head+AUDIT_SIZE)%AUDIT_SIZE;
+      _head=next;
+    }
+  }
+  if( (_cursor<AUDIT_START) || (_cursor>=AUDIT_END) || (n>=AUDIT_SIZE) ) {
+    _cursor=_head=AUDIT_START;
+    _context=version=_store.version();
+    boot=false;
+    EEPROM.write(_head,AUDIT_FREE);
+    _save_cursor();
+  }
+
+  _version=_store.version();
+  _last=0;
+  _stamped=false;
+  if(!boot) _queue(AUDIT_BOOT,0,NULL);
+  if(version!=_version) _queue(AUDIT_BANK,_version,NULL);
+}
+
+/*
+** log a key that was let in, only queues it in ram
+*/
+void DoorduinoAudit::append(byte *addr) {
+  int slot;
+
+  if(_store.legacy()) return;
+  if(_store.version()!=_version) {
+    if(!_queue(AUDIT_BANK,_store.version(),NULL)) return;
+    _version=_store.version();
+  }
+  slot=_store.find_slot(addr);
+  _queue((slot==-1)?AUDIT_ADDR:slot,0,addr);
+}
+
+/*
+** bytes in the log that have not been uploaded yet
+*/
+unsigned int DoorduinoAudit::pending(void) {
+  return (_head-_cursor+AUDIT_SIZE)%AUDIT_SIZE;
+}
+
+unsigned int DoorduinoAudit::dropped(void) {
+  return _dropped;
+}
+
+unsigned int DoorduinoAudit::uploaded(void) {
+  return _uploaded;
+}
+
+/*
+** the time of this restart is logged once the clock is set
+*/
+void DoorduinoAudit::iteration(void) {
+  if( !_stamped && (_clock.hour()!=CLOCK_UNSET) ) {
+    _stamped=_queue(AUDIT_TIME,0,NULL);
+  }
+  _flush();
+
+  if( (_state==AUDIT_IDLE) && (_cursor!=_head) && timeout() ) {
+    _state=AUDIT_WAIT;
+  }
+}
+
+/*
+** nothing to upload keeps it asleep until the next key, an
+** upload keeps the net client awake
+*/
+int DoorduinoAudit::idle(void) {
+  if(_e_count>0) return 0;
+  if(_state!=AUDIT_IDLE) return SLEEP_FOREVER;
+  return (_cursor==_head)?SLEEP_FOREVER:_timeout;
+}
+
+bool DoorduinoAudit::_queue(byte type, uint16_t version, byte *addr) {
+  DoorduinoAuditEvent *ev;
+
+  if(_e_count==AUDIT_QUEUE) {
+    _dropped++;
+    return false;
+  }
+  ev=&_events[(_e_head+_e_count)%AUDIT_QUEUE];
+  ev->type=type;
+  ev->version=version;
+  ev->time=millis();
+  if(addr) memcpy(ev->addr,addr,8);
+  _e_count++;
+  return true;
+}
+
+/*
+** encode queued events and write them to the log, the oldest
+** records are given up when the ring is full
+*/
+void DoorduinoAudit::_flush(void) {
+  while( (_e_count>0) && !over_budget() ) {
+    DoorduinoAuditEvent *ev=&_events[_e_head];
+    byte rec[AUDIT_MAX_RECORD];
+    byte len=0;
+
+    rec[len++]=ev->type;
+    if(ev->type==AUDIT_BANK) {
+      rec[len++]=ev->version>>8;
+      rec[len++]=ev->version&0xff;
+    } else if(ev->type==AUDIT_BOOT) {
+      _last=0;
+    } else if(ev->type==AUDIT_TIME) {
+      unsigned long booted=(_clock.seconds()+CLOCK_WEEK-(millis()/1000)%CLOCK_WEEK)%CLOCK_WEEK;
+
+      rec[len++]=booted>>16;
+      rec[len++]=(booted>>8)&0xff;
+      rec[len++]=booted&0xff;
+    } else {
+      unsigned long delta=(ev->time-_last)/1000;
+
+      _last+=delta*1000;
+      do {
+        rec[len]=delta&0x7f;
+        delta>>=7;
+        if(delta) rec[len]|=0x80;
+        len++;
+      } while(delta);
+      if(ev->type==AUDIT_ADDR) {
+        memcpy(rec+len,ev->addr,8);
+        len+=8;
+      }
+    }
+
+    if(pending()+len+1>AUDIT_SIZE) {
+      // an upload in flight would move the cursor back
+      if(_state==AUDIT_SENT) _state=AUDIT_IDLE;
+      while(pending()+len+1>AUDIT_SIZE) {
+        TRACE(TR_AUDIT_DROPPED,0,_cursor);
+        if(EEPROM.read(_cursor)==AUDIT_BANK) {
+          _context=(EEPROM.read(_next(_cursor,1))<<8)|EEPROM.read(_next(_cursor,2));
+        }
+        _cursor=_skip(_cursor);
+        _dropped++;
+      }
+      _save_cursor();
+    }
+
+    _write(rec,len);
+    _e_head=(_e_head+1)%AUDIT_QUEUE;
+    _e_count--;
+  }
+}
+
+/*
+** the old end marker is overwritten last, a reset halfway
+** leaves the log as it was before the record
+*/
+void DoorduinoAudit::_write(byte *rec, byte len) {
+  for(byte i=1;i<len;i++) {
+    EEPROM.write(_next(_head,i),rec[i]);
+  }
+  EEPROM.write(_next(_head,len),AUDIT_FREE);
+  EEPROM.write(_head,rec[0]);
+  _head=_next(_head,len);
+}
+
+int DoorduinoAudit::_next(int pos, int n) {
+  pos+=n;
+  if(pos>=AUDIT_END) pos-=AUDIT_SIZE;
+  return pos;
+}
+
+/*
+** position of the record after the one at pos
+*/
+int DoorduinoAudit::_skip(int pos) {
+  byte type=EEPROM.read(pos);
+
+  if(type==AUDIT_BOOT) return _next(pos,1);
+  if(type==AUDIT_BANK) return _next(pos,3);
+  if(type==AUDIT_TIME) return _next(pos,4);
+  pos=_next(pos,1);
+  _delta(&pos);
+  if(type==AUDIT_ADDR) pos=_next(pos,8);
+  return pos;
+}
+
+/*
+** read a delta at *pos and move past it
+*/
+unsigned long DoorduinoAudit::_delta(int *pos) {
+  unsigned long delta=0;
+  byte b;
+
+  for(byte shift=0;shift<35;shift+=7) {
+    b=EEPROM.read(*pos);
+    *pos=_next(*pos,1);
+    delta|=(unsigned long)(b&0x7f)<<shift;
+    if(!(b&0x80)) break;
+  }
+  return delta;
+}
+
+void DoorduinoAudit::_save_cursor(void) {
+  byte v[4]={ (byte)(_cursor>>8), (byte)(_cursor&0xff), (byte)(_context>>8), (byte)(_context&0xff) };
+
+  for(byte i=0;i<4;i++) {
+    if(EEPROM.read(AUDIT_CURSOR+i)!=v[i]) EEPROM.write(AUDIT_CURSOR+i,v[i]);
+  }
+}
+
+bool DoorduinoAudit::http_pending(void) {
+  return _state==AUDIT_WAIT;
+}
+
+/*
+** send the records after the cursor, up to AUDIT_UPLOAD key
+** events. Keys are sent as the hash of secret1 and their
+** address when their slot can still be resolved, else as
+** the slot number for the server to look up in that version
+**
+** GET /audit.php?up=<seconds since boot>&log=v<version>,<record>,..
+**
+** record is b (boot), t<seconds> (local time of that boot),
+** v<version> (bank switch), <delta>k<hash> or <delta>s<slot>
+*/
+void DoorduinoAudit::http_request(Print &out) {
+  int pos=_cursor;
+  uint16_t context=_context;
+  byte events=0;
+
+  print_P(out,str_audit);
+  out.print(millis()/1000);
+  print_P(out,str_log);
+  out.print((unsigned int)context);
+
+  while( (pos!=_head) && (events<AUDIT_UPLOAD) ) {
+    byte type=EEPROM.read(pos);
+
+    out.print(',');
+    if(type==AUDIT_BOOT) {
+      out.print('b');
+      pos=_next(pos,1);
+    } else if(type==AUDIT_TIME) {
+      unsigned long booted=0;
+
+      for(byte i=1;i<4;i++) {
+        booted=(booted<<8)|EEPROM.read(_next(pos,i));
+      }
+      out.print('t');
+      out.print(booted);
+      pos=_next(pos,4);
+    } else if(type==AUDIT_BANK) {
+      context=(EEPROM.read(_next(pos,1))<<8)|EEPROM.read(_next(pos,2));
+      out.print('v');
+      out.print((unsigned int)context);
+      pos=_next(pos,3);
+    } else {
+      byte addr[8];
+      bool known=true;
+
+      pos=_next(pos,1);
+      out.print(_delta(&pos));
+      if(type==AUDIT_ADDR) {
+        for(byte i=0;i<8;i++) {
+          addr[i]=EEPROM.read(pos);
+          pos=_next(pos,1);
+        }
+      } else {
+        known=(context==_store.version()) && (_store.get_slot(type,addr)&KEY_INUSE);
+      }
+
+      if(known) {
+        uint8_t *hash;
+
+        Sha256.init();
+        print_P(Sha256,_secret1);
+        for(byte i=0;i<8;i++) {
+          Sha256.print(addr[i]);
+        }
+        hash=Sha256.result();
+        out.print('k');
+        print_hex(out,hash,32);
+      } else {
+        out.print('s');
+        out.print((unsigned int)type);
+      }
+      events++;
+    }
+  }
+
+  _sent=pos;
+  _sent_context=context;
+  _sent_events=events;
+  _state=AUDIT_SENT;
+}
+
+/*
+** the cursor only moves once the server answered 200, and
+** not at all when the records sent were given up meanwhile
+*/
+void DoorduinoAudit::http_done(int status) {
+  bool sent=(_state==AUDIT_SENT);
+
+  _state=AUDIT_IDLE;
+  if(status!=200) {
+    TRACE(TR_AUDIT_FAILED,0,status);
+    setTimeout(AUDIT_RETRY);
+    return;
+  }
+  if(!sent) return;
+
+  _cursor=_sent;
+  _context=_sent_context;
+  _save_cursor();
+  _uploaded+=_sent_events;
+  TRACE(TR_AUDIT_UPLOAD,_sent_events,_cursor);
+  setTimeout(0);
+}
@@ -0,0 +1,115 @@
+/*
+** Doorduino audit log
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+*/
+
+#ifndef DoorduineAudit_h
+#define DoorduineAudit_h
+
+#include <DoorduinoComponent.h>
+#include <DoorduinoStore.h>
+#include <DoorduinoClock.h>
+#include "WProgram.h"
+
+/*
+** the log is a ring in the eeprom the key store leaves free,
+** the last 4 bytes before the store boot counter hold the upload
+** cursor and the store version in effect at the cursor
+*/
+#define AUDIT_START		STORE_FREE
+#define AUDIT_CURSOR		(STORE_BOOTS-4)
+#define AUDIT_CONTEXT		(STORE_BOOTS-2)
+#define AUDIT_END		AUDIT_CURSOR
+#define AUDIT_SIZE		(AUDIT_END-AUDIT_START)
+
+#define AUDIT_QUEUE		4	// events waiting in ram for the eeprom
+#define AUDIT_UPLOAD		4	// key events per upload request
+#define AUDIT_RETRY		300	// iterations between uploads while offline
+
+/*
+** records, the first byte tells the type
+**
+** <slot> <delta>               - key in that slot of the active bank was let in
+** AUDIT_ADDR <delta> addr(8)   - key that is not in the store was let in
+** AUDIT_BANK version(2)        - slots in later records refer to this version
+** AUDIT_BOOT                   - board restarted, deltas start from boot,
+**                                restarts without keys in between share one
+** AUDIT_TIME seconds(3)        - the last restart was at this local time,
+**                                seconds since monday 00:00. Written once the
+**                                clock is set, a later one for the same
+**                                AUDIT_BOOT is for a later restart
+** AUDIT_FREE                   - end of the log
+**
+** delta is the number of seconds since the previous key record,
+** 7 bits per byte, least significant first, high bit set on all
+** but the last byte. Slots do not track local changes to the key
+** store, a slot that was reused after a key was deleted will be
+** uploaded as its new key.
+*/
+#define AUDIT_TIME		0xfb
+#define AUDIT_BANK		0xfc
+#define AUDIT_ADDR		0xfd
+#define AUDIT_BOOT		0xfe
+#define AUDIT_FREE		0xff
+
+#define AUDIT_MAX_RECORD	14	// AUDIT_ADDR with a 5 byte delta
+
+#define AUDIT_IDLE		0
+#define AUDIT_WAIT		1	// for the net client to run the upload
+#define AUDIT_SENT		2
+
+typedef struct {
+  byte type;		// slot or one of the tags above
+  uint16_t version;
+  unsigned long time;	// millis()
+  byte addr[8];
+} DoorduinoAuditEvent;
+
+/*
+** keeps access events the log server did not get, appending
+** only queues them in ram so it costs nothing on the open path,
+** iteration() writes them out and uploads from the saved cursor
+** through the net client
+*/
+class DoorduinoAudit : public DoorduinoComponent, public DoorduinoHttpRequest {
+  public:
+    DoorduinoAudit(DoorduinoEnvironment *e, DoorduinoStore &store, DoorduinoClock &clock, PGM_P secret1);
+    void begin(void);
+    void append(byte *addr);
+    void iteration(void);
+    int idle(void);
+    unsigned int pending(void);
+    unsigned int dropped(void);
+    unsigned int uploaded(void);
+    bool http_pending(void);
+    void http_request(Print &out);
+    void http_done(int status);
+  private:
+    bool _queue(byte type, uint16_t version, byte *addr);
+    void _flush(void);
+    void _write(byte *rec, byte len);
+    int _next(int pos, int n);
+    int _skip(int pos);
+    unsigned long _delta(int *pos);
+    void _save_cursor(void);
+    DoorduinoStore &_store;
+    DoorduinoClock &_clock;
+    PGM_P _secret1;
+    DoorduinoAuditEvent _events[AUDIT_QUEUE];
+    byte _e_head;
+    byte _e_count;
+    uint16_t _version;
+    unsigned long _last;
+    bool _stamped;
+    int _head;
+    int _cursor;
+    uint16_t _context;
+    int _sent;
+    uint16_t _sent_context;
+    byte _sent_events;
+    unsigned int _dropped;
+    unsigned int _uploaded;
+};
+
+#endif
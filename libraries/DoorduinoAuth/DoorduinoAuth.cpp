@@ -5,37 +5,50 @@
 #include <OneWire.h>
 #include <DoorduinoGpio.h>
 #include <DoorduinoStore.h>
+#include <DoorduinoTrace.h>
 #include "DoorduinoAuth.h"
 
-#ifdef DEBUG
-#define DBG(...) Serial.print(__VA_ARGS__)
-#else
-#define DBG(...) {}
-#endif
-
 #define CONFIRM { setTimeout(CONFIRM_TIME); _state=14; }
 #define FAIL { setTimeout(FAIL_TIME); _state=15; }
 
-DoorduinoAuth::DoorduinoAuth(DoorduinoEnvironment *e,DoorduinoStore _store, DoorduinoGpio _gpio, int pin) : 
+/*
+** schedules points to classes weekly schedules of SCHEDULE_BYTES
+** each in flash, for key classes 1 and up
+*/
+DoorduinoAuth::DoorduinoAuth(DoorduinoEnvironment *e,DoorduinoStore &store, DoorduinoGpio &gpio, DoorduinoClock &clock, const prog_uchar *schedules, byte classes, int pin) : 
   DoorduinoComponent(e), 
-  _store(_store), 
-  _gpio(_gpio), 
+  _store(store), 
+  _gpio(gpio), 
+  _clock(clock),
   _ds(pin) 
 {
+  _schedules=schedules;
+  _classes=classes;
   setTimeout(18);
   _s1=_s2=_s3=false;
 }
 
+/*
+** only the idle blink pattern can sleep, a key touching the
+** reader or a button wakes the board up through a pin change
+*/
+int DoorduinoAuth::idle(void) {
+  switch(_state) {
+    case 2:
+    case 3:
+    case 4:
+    case 22:
+      return _timeout;
+  }
+  return 0;
+}
+
 bool DoorduinoAuth::_scan_bus(byte *addr) {
   if( _ds.search(addr) ) {
-    DBG("R=");
-    for( int i = 0; i < 8; i++) {
-      DBG(addr[i], HEX);
-      DBG(" ");
-    }
-    DBG("\n");
+    TRACE(TR_AUTH_SCAN,0,TRACE_WORD(addr));
+    TRACE(TR_AUTH_SCAN,1,TRACE_WORD(addr+4));
     if ( OneWire::crc8( addr, 7) != addr[7]) {
-      DBG("CRC is not valid!\n");
+      TRACE(TR_AUTH_CRC,0,0);
       return false;
     }
     return true;
@@ -60,12 +73,15 @@ void DoorduinoAuth::iteration(void) {
       _gpio.set_led( (( _state==2 ) || ( _state==4 ))?LED_BLACK:LED_BLUE);
 
       if(_env->s1) {			// button 1 - add key
+        _env->s1=false;
         _s1=true;
         _state=5;
       } else if(_env->s2) {		// button 2 - revoke key
+        _env->s2=false;
         _s2=true;
         _state=6;
       } else if(_env->s3) {		// button 3 - add admin key
+        _env->s3=false;
         _s3=true;
         _state=7;
       } else if(_scan_bus(_env->addr)) {	// scan onewire bus
@@ -151,14 +167,24 @@ void DoorduinoAuth::iteration(void) {
       _state=1;
       break;
 
-    case 17:
-      if(_store.find_key(_env->addr)!=-1) {
+    case 17: {
+      _env->decisions++;
+      // class 0 keys may always enter, others need their schedule
+      // to have the bit for this hour set
+      byte flags=_store.lookup_flags(_env->addr);
+      byte cls=(flags&KEY_CLASS)>>KEY_CLASS_SHIFT;
+      byte hour=_clock.hour();
+
+      if( (flags&KEY_INUSE) && ( (cls==0) ||
+          ((cls<=_classes) && SCHEDULE_ALLOWS(_schedules+(cls-1)*SCHEDULE_BYTES,hour)) ) ) {
         _state=18;
       } else {
+        if(flags&KEY_INUSE) TRACE(TR_AUTH_SCHEDULE,cls,hour);
         setTimeout(FAIL_TIME);
         _state=21;
       }
       break;
+    }
 
     case 18:
       _gpio.set_led(LED_GREEN);
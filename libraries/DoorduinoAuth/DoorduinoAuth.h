@@ -11,6 +11,7 @@
 #include <DoorduinoComponent.h>
 #include <DoorduinoStore.h>
 #include <DoorduinoGpio.h>
+#include <DoorduinoClock.h>
 #include "WProgram.h"
 
 #define SCAN_ADMIN_TIME		100
@@ -21,13 +22,16 @@
 
 class DoorduinoAuth : public DoorduinoComponent {
   public:
-    DoorduinoAuth(DoorduinoEnvironment *e, DoorduinoStore store, DoorduinoGpio gpio, int pin);
+    DoorduinoAuth(DoorduinoEnvironment *e, DoorduinoStore &store, DoorduinoGpio &gpio, DoorduinoClock &clock, const prog_uchar *schedules, byte classes, int pin);
     void iteration(void);
+    int idle(void);
   private:
     bool _scan_bus(byte *addr);
-    DoorduinoStore _store;
-    DoorduinoGpio _gpio;
-    int _state;
+    DoorduinoStore &_store;
+    DoorduinoGpio &_gpio;
+    DoorduinoClock &_clock;
+    const prog_uchar *_schedules;
+    byte _classes;
     OneWire _ds;
     bool _s1;
     bool _s2;
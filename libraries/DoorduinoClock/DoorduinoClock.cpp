@@ -0,0 +1,173 @@
+/*
+** Doorduino week clock and access schedules
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+*/
+
+#include <inttypes.h>
+#include <sha256.h> // https://github.com/Cathedrow/Cryptosuite
+#include <DoorduinoTrace.h>
+#include "WProgram.h"
+#include "DoorduinoClock.h"
+
+static const prog_char str_gettime[] PROGMEM = "/time.php?nonce=";
+
+/*
+** interval is the number of iterations between time syncs
+*/
+DoorduinoClock::DoorduinoClock(DoorduinoEnvironment *e, DoorduinoStore &store, PGM_P secret2, int interval) :
+  DoorduinoComponent(e),
+  _store(store)
+{
+  _secret2=secret2;
+  _interval=interval;
+  _state=CLOCK_IDLE;
+  _set=false;
+  _hour=CLOCK_UNSET;
+  _requests=0;
+  _nonce=0;
+}
+
+/*
+** set local time, in seconds since monday 00:00
+*/
+void DoorduinoClock::set(unsigned long seconds) {
+  _seconds=seconds%CLOCK_WEEK;
+  _anchor=millis();
+  _set=true;
+  _update();
+}
+
+/*
+** hour of the week, 0 is monday 00:00-00:59, CLOCK_UNSET
+** if the clock has not been set since boot
+*/
+byte DoorduinoClock::hour(void) {
+  return _hour;
+}
+
+/*
+** local time in seconds since monday 00:00, only meaningful
+** once hour() is not CLOCK_UNSET
+*/
+unsigned long DoorduinoClock::seconds(void) {
+  return (_seconds+(millis()-_anchor)/1000)%CLOCK_WEEK;
+}
+
+void DoorduinoClock::iteration(void) {
+  _update();
+
+  switch(_state) {
+    case CLOCK_IDLE:
+      if( timeout() && (_requests<CLOCK_REQUESTS) ) _state=CLOCK_WAIT;
+      break;
+
+    case CLOCK_HMAC:
+      hmac_init_P(_secret2);
+      Sha256.print(_nonce);
+      Sha256.print(' ');
+      Sha256.print(_value);
+      memcpy(_mac,Sha256.resultHmac(),32);
+      _digits=0;
+      _diff=0;
+      _state=CLOCK_MAC;
+      break;
+  }
+}
+
+/*
+** a request waiting for its turn keeps the net client awake
+*/
+int DoorduinoClock::idle(void) {
+  if(_state==CLOCK_IDLE) return _timeout;
+  if(_state==CLOCK_WAIT) return SLEEP_FOREVER;
+  return 0;
+}
+
+/*
+** the anchor moves along every hour so millis() wrapping
+** around after 49 days does not matter
+*/
+void DoorduinoClock::_update(void) {
+  unsigned long elapsed;
+
+  if(!_set) return;
+  elapsed=(millis()-_anchor)/1000;
+  if(elapsed>=3600) {
+    _seconds=(_seconds+elapsed)%CLOCK_WEEK;
+    _anchor+=elapsed*1000;
+    elapsed=0;
+  }
+  _hour=((_seconds+elapsed)%CLOCK_WEEK)/3600;
+}
+
+bool DoorduinoClock::http_pending(void) {
+  return _state==CLOCK_WAIT;
+}
+
+void DoorduinoClock::http_request(Print &out) {
+  _nonce=((unsigned long)_store.boots()<<16)|(++_requests);
+  print_P(out,str_gettime);
+  out.print(_nonce);
+
+  _value=0;
+  _digits=0;
+  _state=CLOCK_SECONDS;
+}
+
+bool DoorduinoClock::http_ready(void) {
+  return _state!=CLOCK_HMAC;
+}
+
+/*
+** returns false once the answer is complete or wrong, the
+** mac is worked out by the next iteration in between
+*/
+bool DoorduinoClock::http_body(char c) {
+  switch(_state) {
+    case CLOCK_SECONDS:
+      if( (c>='0') && (c<='9') && (_digits<7) ) {
+        _value=_value*10+(c-'0');
+        _digits++;
+        return true;
+      }
+      if( (c==' ') && (_digits>0) ) {
+        _state=CLOCK_HMAC;
+        return true;
+      }
+      _fail(1);
+      break;
+
+    case CLOCK_MAC: {
+      byte b=_mac[_digits/2];
+
+      if(c>='A' && c<='F') c+='a'-'A';
+      _diff|=c^hexdigit((_digits&1)?b:(b>>4));
+      if(++_digits<64) return true;
+
+      if( (_diff!=0) || (_value>=CLOCK_WEEK) ) {
+        _fail(2);
+        break;
+      }
+      set(_value);
+      TRACE(TR_CLOCK_SET,_hour,_value);
+      _state=CLOCK_IDLE;
+      setTimeout(_interval);
+      break;
+    }
+  }
+  return false;
+}
+
+/*
+** the request ended before the answer was complete
+*/
+void DoorduinoClock::http_done(int status) {
+  if(_state!=CLOCK_IDLE) _fail(3);
+}
+
+void DoorduinoClock::_fail(byte reason) {
+  TRACE(TR_CLOCK_FAILED,reason,0);
+  _state=CLOCK_IDLE;
+  setTimeout(CLOCK_RETRY);
+}
@@ -0,0 +1,95 @@
+/*
+** Doorduino week clock and access schedules
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+*/
+
+#ifndef DoorduineClock_h
+#define DoorduineClock_h
+
+#include <avr/pgmspace.h>
+#include <DoorduinoComponent.h>
+#include <DoorduinoStore.h>
+#include "WProgram.h"
+
+#define CLOCK_WEEK		604800UL	// seconds
+#define CLOCK_UNSET		168	// hour() until the clock has been set
+#define CLOCK_RETRY		300	// iterations before retrying a failed sync
+#define CLOCK_REQUESTS		0xffff	// requests per boot, nonces would repeat after
+
+/*
+** GET /time.php?nonce=<n> is answered with a body of
+**
+** <seconds> <hmac, 64 hex>
+**
+** seconds is local time since monday 00:00, hmac is HMAC-SHA256
+** with secret2 over "<n> <seconds>" so answers cannot be replayed.
+** n is the boot count in the high 16 bits and the number of the
+** request since boot in the low 16, it never repeats.
+*/
+#define CLOCK_IDLE		0
+#define CLOCK_WAIT		1	// for the net client to run the request
+#define CLOCK_SECONDS		2
+#define CLOCK_HMAC		3	// work out the expected mac
+#define CLOCK_MAC		4
+
+/*
+** weekly schedules, one bit per hour of the week starting
+** monday 00:00, built at compile time into flash:
+**
+**   const prog_uchar schedules[][SCHEDULE_BYTES] PROGMEM = {
+**     WEEKDAYS(HOURS(8,18)),		// class 1
+**     WEEK(0,0,0,0,HOURS(18,24),HOURS(0,24),HOURS(0,24)),	// class 2
+**   };
+**
+** HOURS(from,to) allows from <= hour < to. The extra last byte
+** is always 0, it holds bit CLOCK_UNSET so a key with a schedule
+** is refused until the clock is set.
+*/
+#define SCHEDULE_BYTES		22
+#define HOURS(from,to)		( ((1UL<<(to))-1) & ~((1UL<<(from))-1) )
+#define DAY(h)			(prog_uchar)((h)&0xff), (prog_uchar)(((h)>>8)&0xff), (prog_uchar)(((h)>>16)&0xff)
+#define WEEK(mo,tu,we,th,fr,sa,su)	{ DAY(mo), DAY(tu), DAY(we), DAY(th), DAY(fr), DAY(sa), DAY(su), 0 }
+#define WEEKDAYS(h)		WEEK(h,h,h,h,h,0,0)
+
+/*
+** true if the schedule allows access in the given hour of the week
+*/
+#define SCHEDULE_ALLOWS(s,hour)	(pgm_read_byte((s)+((hour)>>3)) & (1<<((hour)&7)))
+
+/*
+** keeps local time of week from a signed time server, the hour
+** is worked out once per iteration so checks only read a byte
+*/
+class DoorduinoClock : public DoorduinoComponent, public DoorduinoHttpRequest {
+  public:
+    DoorduinoClock(DoorduinoEnvironment *e, DoorduinoStore &store, PGM_P secret2, int interval);
+    void iteration(void);
+    int idle(void);
+    void set(unsigned long seconds);
+    byte hour(void);
+    unsigned long seconds(void);
+    bool http_pending(void);
+    void http_request(Print &out);
+    bool http_ready(void);
+    bool http_body(char c);
+    void http_done(int status);
+  private:
+    void _update(void);
+    void _fail(byte reason);
+    DoorduinoStore &_store;
+    PGM_P _secret2;
+    int _interval;
+    bool _set;
+    unsigned long _seconds;
+    unsigned long _anchor;
+    byte _hour;
+    uint16_t _requests;
+    unsigned long _nonce;
+    unsigned long _value;
+    byte _digits;
+    byte _diff;
+    uint8_t _mac[32];
+};
+
+#endif
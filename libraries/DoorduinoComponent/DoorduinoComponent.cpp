@@ -2,17 +2,89 @@
 **
 */
 
+#include <avr/wdt.h>
+#include <sha256.h> // https://github.com/Cathedrow/Cryptosuite
+#include <DoorduinoTrace.h>
 #include "DoorduinoComponent.h"
 
-#ifdef DEBUG
-#define DBG(...) Serial.print(__VA_ARGS__)
-#else
-#define DBG(...) {}
+/*
+** index of the component currently running, kept across a
+** watchdog reset so the culprit can be reported after reboot
+*/
+static byte _running __attribute__ ((section (".noinit")));
+
+/*
+** reset cause, saved before the constructors of globals run
+*/
+static byte _reset_flags __attribute__ ((section (".noinit")));
+
+static const prog_char hexdigits[] PROGMEM = "0123456789abcdef";
+static const prog_char str_watchdog[] PROGMEM = "watchdog reset in task ";
+static const prog_char str_task[] PROGMEM = "task ";
+static const prog_char str_budget[] PROGMEM = ": budget ";
+static const prog_char str_worst[] PROGMEM = "us worst ";
+static const prog_char str_overruns[] PROGMEM = "us overruns ";
+
+/*
+** runs from .init3, before any constructor. A watchdog reset
+** leaves the watchdog armed at its shortest period, which would
+** reset the board again in the first delay(), so it is stopped
+** here until begin(). Optiboot clears MCUSR and hands the reset
+** cause over in r2 instead.
+*/
+void sched_reset_cause(void) __attribute__ ((naked, used, section (".init3")));
+void sched_reset_cause(void) {
+  byte flags=MCUSR;
+
+#ifdef __AVR__
+  if(flags==0) asm volatile ("mov %0, r2" : "=r" (flags));
 #endif
+  _reset_flags=flags;
+  MCUSR=0;
+  wdt_disable();
+}
+
+void print_P(Print &out, PGM_P s) {
+  char c;
+
+  while( (c=pgm_read_byte(s++)) ) {
+    out.print(c);
+  }
+}
+
+void println_P(Print &out, PGM_P s) {
+  print_P(out,s);
+  out.println();
+}
+
+/*
+** initHmac wants the key in ram, it is only copied to the
+** stack for the duration of the call
+*/
+void hmac_init_P(PGM_P key) {
+  uint8_t buf[BLOCK_LENGTH];
+  int len=strlen_P(key);
+
+  if(len>BLOCK_LENGTH) len=BLOCK_LENGTH;
+  memcpy_P(buf,key,len);
+  Sha256.initHmac(buf,len);
+}
+
+char hexdigit(byte v) {
+  return pgm_read_byte(hexdigits+(v&0xf));
+}
+
+void print_hex(Print &out, uint8_t *buf, byte len) {
+  for(byte i=0;i<len;i++) {
+    out.print(hexdigit(buf[i]>>4));
+    out.print(hexdigit(buf[i]));
+  }
+}
 
 DoorduinoComponent::DoorduinoComponent(DoorduinoEnvironment *e) {
   _timeout=0;
   _state=1;
+  _deadline=0;
   _env=e;
 }
 
@@ -28,6 +100,202 @@ void DoorduinoComponent::setTimeout(int t) {
   _timeout=t;
 }
 
-void iteration(void) {
+void DoorduinoComponent::iteration(void) {
   // noop
 }
+
+/*
+** number of ticks the component has nothing to do, if nothing
+** else happens. Components that do not know stay awake
+*/
+int DoorduinoComponent::idle(void) {
+  return 0;
+}
+
+/*
+** count down the timeout for ticks spent asleep
+*/
+void DoorduinoComponent::elapse(int ticks) {
+  _timeout=(_timeout>ticks)?_timeout-ticks:0;
+}
+
+int DoorduinoComponent::state(void) {
+  return _state;
+}
+
+/*
+** set by the scheduler before each iteration, components that
+** loop internally should check over_budget() and yield
+*/
+void DoorduinoComponent::setDeadline(unsigned long deadline) {
+  _deadline=deadline;
+}
+
+/*
+** true once the budget is used up, or when less than need
+** microseconds of it are left
+*/
+bool DoorduinoComponent::over_budget(unsigned long need) {
+  if(_deadline==0) return false;
+  return (long)(micros()+need-_deadline)>=0;
+}
+
+/*
+** after a failed connect nothing connects for NET_BACKOFF, so
+** an outage costs one attempt every few seconds rather than one
+** per request.
+** returns the ticks left to wait, 0 when connecting is fine
+*/
+int DoorduinoComponent::net_wait(void) {
+  unsigned long since=millis()-_env->net_failed;
+
+  if( (_env->net_failed==0) || (since>=NET_BACKOFF) ) return 0;
+  return (NET_BACKOFF-since+SCHED_TICK-1)/SCHED_TICK;
+}
+
+void DoorduinoComponent::net_failed(void) {
+  _env->net_failed=millis();
+}
+
+bool DoorduinoHttpRequest::http_pending(void) {
+  return false;
+}
+
+void DoorduinoHttpRequest::http_request(Print &out) {
+  // noop
+}
+
+bool DoorduinoHttpRequest::http_ready(void) {
+  return true;
+}
+
+bool DoorduinoHttpRequest::http_body(char c) {
+  return false;
+}
+
+void DoorduinoHttpRequest::http_done(int status) {
+  // noop
+}
+
+DoorduinoScheduler::DoorduinoScheduler() {
+  _count=0;
+  _stalled=SCHED_NONE;
+  _last_tick=0;
+  _sleep=NULL;
+  _carry=0;
+}
+
+/*
+** register a component with a budget in microseconds per tick,
+** components run in order of registration
+** returns the task index, or SCHED_NONE when all slots are taken
+*/
+byte DoorduinoScheduler::add(DoorduinoComponent *c, unsigned long budget) {
+  if(_count==SCHED_MAX_COMPONENTS) return SCHED_NONE;
+
+  _tasks[_count].component=c;
+  _tasks[_count].budget=budget;
+  _tasks[_count].worst=0;
+  _tasks[_count].overruns=0;
+  return _count++;
+}
+
+/*
+** check for a previous watchdog reset and arm the watchdog
+*/
+void DoorduinoScheduler::begin(void) {
+  if(_reset_flags&(1<<WDRF)) {
+    _stalled=_running;
+  }
+  _running=SCHED_NONE;
+  wdt_enable(WDTO_2S);
+  _last_tick=millis();
+}
+
+/*
+** sleep through ticks in which no component has work
+*/
+void DoorduinoScheduler::sleep_with(DoorduinoSleep *s) {
+  _sleep=s;
+}
+
+void DoorduinoScheduler::tick(void) {
+  for(byte i=0;i<_count;i++) {
+    DoorduinoTask *t=&_tasks[i];
+    unsigned long start=micros();
+
+    wdt_reset();
+    _running=i;
+    // or'ed with 1 so a deadline is never 0, which means none
+    t->component->setDeadline((start+t->budget)|1);
+    t->component->iteration();
+    _running=SCHED_NONE;
+
+    unsigned long used=micros()-start;
+    if(used>t->worst) t->worst=used;
+    if(used>t->budget) {
+      t->overruns++;
+      TRACE(TR_SCHED_OVERRUN,i,used);
+    }
+  }
+  wdt_reset();
+
+  if(_sleep) {
+    int ticks=SLEEP_FOREVER;
+
+    for(byte i=0;i<_count;i++) {
+      int t=_tasks[i].component->idle();
+      if(t<ticks) ticks=t;
+    }
+    if(ticks>0) {
+      // the part of a tick left over is kept for the next sleep
+      unsigned long slept=_sleep->sleep((unsigned long)ticks*SCHED_TICK)+_carry;
+
+      ticks=slept/SCHED_TICK;
+      _carry=slept%SCHED_TICK;
+      for(byte i=0;i<_count;i++) {
+        _tasks[i].component->elapse(ticks);
+      }
+      _last_tick=millis();
+      return;
+    }
+  }
+
+  // sleep away the remainder of the tick
+  unsigned long elapsed=millis()-_last_tick;
+  if(elapsed<SCHED_TICK) delay(SCHED_TICK-elapsed);
+  _last_tick=millis();
+}
+
+void DoorduinoScheduler::report(void) {
+  if(_stalled!=SCHED_NONE) {
+    print_P(Serial,str_watchdog);
+    Serial.println(_stalled, DEC);
+  }
+  for(byte i=0;i<_count;i++) {
+    print_P(Serial,str_task);
+    Serial.print(i, DEC);
+    print_P(Serial,str_budget);
+    Serial.print(_tasks[i].budget);
+    print_P(Serial,str_worst);
+    Serial.print(_tasks[i].worst);
+    print_P(Serial,str_overruns);
+    Serial.println(_tasks[i].overruns);
+  }
+}
+
+unsigned int DoorduinoScheduler::overruns(byte task) {
+  return _tasks[task].overruns;
+}
+
+unsigned long DoorduinoScheduler::worst(byte task) {
+  return _tasks[task].worst;
+}
+
+/*
+** task that was running when the watchdog last reset
+** the board, SCHED_NONE if the last reset was not a stall
+*/
+byte DoorduinoScheduler::stalled(void) {
+  return _stalled;
+}
@@ -7,7 +7,21 @@
 #ifndef DoorduineComponent_h
 #define DoorduineComponent_h
 
+#include <avr/pgmspace.h>
 #include "WProgram.h"
+#include "DoorduinoConfig.h"
+
+#define SCHED_MAX_COMPONENTS	8	// registration slots
+#define SCHED_TICK		100	// milliseconds per scheduler tick
+#define SCHED_NONE		0xff	// no component running
+#define SCHED_WATCHDOG		2000	// milliseconds a component may run, WDTO_2S
+#define NET_BACKOFF		5000	// milliseconds without connects after a failed one
+
+#define SLEEP_FOREVER		0x7fff	// idle(): nothing to do until woken
+#define SLEEP_MIN_MS		16	// shortest watchdog period
+#define SLEEP_DECISION		10	// ticks after a pin wake to wait for a decision
+#define SLEEP_WAKE_TIMER	1
+#define SLEEP_WAKE_PIN		2
 
 typedef struct {
   bool s1;
@@ -15,23 +29,141 @@ typedef struct {
   bool s3;
   byte addr[8];
   bool log_addr;
-  uint8_t revoke_hash[32];
   bool log_revocation;
   bool log_revocation_failed;
   bool loop_closed;
   bool space_closed;
+  byte decisions;	// counts keys the auth state machine decided on
+  unsigned long net_failed;	// millis() of the last failed connect, 0 for none
+  byte net_resets;	// counts ethernet controller resets, they close every socket
 } DoorduinoEnvironment;
 
+/*
+** print strings that live in flash (PROGMEM), works for
+** any Print such as Serial, a socket or Sha256
+*/
+void print_P(Print &out, PGM_P s);
+void println_P(Print &out, PGM_P s);
+
+/*
+** start an HMAC-SHA256 in Sha256 with a key that lives in
+** flash, the key must not be longer than one sha256 block
+*/
+void hmac_init_P(PGM_P key);
+
+/*
+** lower case hex, of the low nibble of v or of a buffer
+*/
+char hexdigit(byte v);
+void print_hex(Print &out, uint8_t *buf, byte len);
+
 class DoorduinoComponent {
   public:
     DoorduinoComponent(DoorduinoEnvironment *e);
     bool timeout(void);
     void setTimeout(int t);
-    void iteration(void);
+    virtual void iteration(void);
+    virtual int idle(void);
+    void elapse(int ticks);
+    int state(void);
+    void setDeadline(unsigned long deadline);
+    bool over_budget(unsigned long need=0);
   protected:
+    int net_wait(void);
+    void net_failed(void);
     int _state;
     int _timeout;
+    unsigned long _deadline;
     DoorduinoEnvironment *_env;
 };
 
+/*
+** components that talk http register with the net client, which
+** runs one request at a time for all of them. http_pending() says
+** there is a request to make, it starts right away when true.
+** Once connected http_request() prints the path and query. Only
+** the body of a 200 response is passed on, a char at a time to
+** http_body() while http_ready() says the component can take one,
+** the rest waits in the ethernet controller. http_body() returns
+** false once it has seen enough. Every request ends in http_done()
+** with the status code, or HTTP_FAILED when no response came.
+*/
+#define HTTP_FAILED		0
+
+class DoorduinoHttpRequest {
+  public:
+    virtual bool http_pending(void);
+    virtual void http_request(Print &out);
+    virtual bool http_ready(void);
+    virtual bool http_body(char c);
+    virtual void http_done(int status);
+};
+
+/*
+** per-component accounting, times in microseconds
+*/
+typedef struct {
+  DoorduinoComponent *component;
+  unsigned long budget;
+  unsigned long worst;
+  unsigned int overruns;
+} DoorduinoTask;
+
+/*
+** powers the mcu down while every component is idle, woken by
+** the watchdog or a pin change on a pin given to wake_on().
+** millis() stands still while asleep and is moved on by the
+** time slept afterwards, as far as the watchdog can tell
+*/
+class DoorduinoSleep : public DoorduinoComponent {
+  public:
+    DoorduinoSleep(DoorduinoEnvironment *e);
+    void wake_on(byte pin);
+    unsigned long sleep(unsigned long ms);
+    void iteration(void);
+    int idle(void);
+    void report(void);
+    unsigned int wakes(byte source);
+    unsigned long asleep(void);
+    unsigned int decisions(void);
+    unsigned long decision_total(void);
+    unsigned long decision_worst(void);
+  private:
+    byte _pcicr;
+    unsigned int _pin_wakes;
+    unsigned int _timer_wakes;
+    unsigned long _asleep;
+    bool _measuring;
+    byte _seen;
+    unsigned long _woke;
+    unsigned int _decisions;
+    unsigned long _decision_total;
+    unsigned long _decision_worst;
+};
+
+/*
+** cooperative scheduler, runs each registered component once
+** per tick, measures it against its budget and keeps the
+** hardware watchdog fed as long as every component returns
+*/
+class DoorduinoScheduler {
+  public:
+    DoorduinoScheduler();
+    byte add(DoorduinoComponent *c, unsigned long budget);
+    void begin(void);
+    void sleep_with(DoorduinoSleep *s);
+    void tick(void);
+    void report(void);
+    unsigned int overruns(byte task);
+    unsigned long worst(byte task);
+    byte stalled(void);
+  private:
+    DoorduinoTask _tasks[SCHED_MAX_COMPONENTS];
+    byte _count;
+    byte _stalled;
+    unsigned long _last_tick;
+    DoorduinoSleep *_sleep;
+    unsigned long _carry;
+};
+
 #endif
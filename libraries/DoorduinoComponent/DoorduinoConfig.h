@@ -0,0 +1,19 @@
+/*
+** Doorduino build switches
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+**
+** The arduino ide compiles each library on its own, a define
+** in the sketch or its config.h never reaches them. Switches
+** the libraries look at are set here, DoorduinoComponent.h
+** includes this file so the sketch and every library agree.
+*/
+
+#ifndef DoorduinoConfig_h
+#define DoorduinoConfig_h
+
+// debug output, binary trace records on the serial port,
+// decode with tools/trace_decode.py
+// #define DEBUG
+
+#endif
@@ -0,0 +1,179 @@
+/*
+** Doorduino low power idle
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+*/
+
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#include "DoorduinoComponent.h"
+
+// kept by the arduino core timer0 interrupt, which stops in power down
+extern volatile unsigned long timer0_millis;
+
+static volatile byte _wake;
+
+static const prog_char str_wakes[] PROGMEM = "wakes pin ";
+static const prog_char str_timer[] PROGMEM = " timer ";
+static const prog_char str_asleep[] PROGMEM = " asleep ";
+static const prog_char str_decisions[] PROGMEM = "ms decisions ";
+static const prog_char str_avg[] PROGMEM = " avg ";
+static const prog_char str_worst[] PROGMEM = "ms worst ";
+static const prog_char str_ms[] PROGMEM = "ms";
+
+ISR(WDT_vect) {
+  _wake|=SLEEP_WAKE_TIMER;
+}
+
+ISR(PCINT0_vect) {
+  _wake|=SLEEP_WAKE_PIN;
+}
+
+ISR(PCINT1_vect) {
+  _wake|=SLEEP_WAKE_PIN;
+}
+
+ISR(PCINT2_vect) {
+  _wake|=SLEEP_WAKE_PIN;
+}
+
+DoorduinoSleep::DoorduinoSleep(DoorduinoEnvironment *e) : DoorduinoComponent(e) {
+  _pcicr=0;
+  _pin_wakes=_timer_wakes=0;
+  _asleep=0;
+  _measuring=false;
+  _decisions=0;
+  _decision_total=_decision_worst=0;
+}
+
+/*
+** wake up when the level of an arduino pin changes, pin change
+** interrupts are only enabled while asleep
+*/
+void DoorduinoSleep::wake_on(byte pin) {
+  if(pin<8) {
+    PCMSK2|=_BV(pin);
+    _pcicr|=_BV(PCIE2);
+  } else if(pin<14) {
+    PCMSK0|=_BV(pin-8);
+    _pcicr|=_BV(PCIE0);
+  } else if(pin<20) {
+    PCMSK1|=_BV(pin-14);
+    _pcicr|=_BV(PCIE1);
+  }
+}
+
+/*
+** power down for up to ms milliseconds in watchdog periods,
+** returns the milliseconds slept. The time of a pin wake within
+** a period is not known, half the period is counted for it.
+** The watchdog runs in interrupt mode while asleep and goes
+** back to resetting the board before this returns.
+*/
+unsigned long DoorduinoSleep::sleep(unsigned long ms) {
+  unsigned long slept=0;
+
+  _wake=0;
+  while( !(_wake&SLEEP_WAKE_PIN) && (ms-slept>=SLEEP_MIN_MS) ) {
+    byte p=9;
+
+    while( ((unsigned long)SLEEP_MIN_MS<<p) > ms-slept ) p--;
+
+    cli();
+    wdt_reset();
+    WDTCSR=_BV(WDCE)|_BV(WDE);
+    WDTCSR=_BV(WDIE)|((p&8)?_BV(WDP3):0)|(p&7);
+    PCIFR=_BV(PCIF0)|_BV(PCIF1)|_BV(PCIF2);
+    PCICR=_pcicr;
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    sleep_enable();
+    sei();
+    sleep_cpu();		// sei lets one more instruction through first
+    sleep_disable();
+    PCICR=0;
+
+    if(_wake&SLEEP_WAKE_PIN) {
+      slept+=(SLEEP_MIN_MS<<p)/2;
+      _pin_wakes++;
+    } else {
+      slept+=SLEEP_MIN_MS<<p;
+      _timer_wakes++;
+    }
+  }
+  wdt_enable(WDTO_2S);
+
+  cli();
+  timer0_millis+=slept;
+  sei();
+  _asleep+=slept;
+
+  if(_wake&SLEEP_WAKE_PIN) {
+    _measuring=true;
+    _seen=_env->decisions;
+    _woke=millis();
+    setTimeout(SLEEP_DECISION);
+  }
+  return slept;
+}
+
+/*
+** time from a pin wake to the next key decision
+*/
+void DoorduinoSleep::iteration(void) {
+  if(!_measuring) return;
+
+  if(_env->decisions!=_seen) {
+    unsigned long took=millis()-_woke;
+
+    _decisions++;
+    _decision_total+=took;
+    if(took>_decision_worst) _decision_worst=took;
+    _measuring=false;
+  } else if(timeout()) {
+    _measuring=false;
+  }
+}
+
+int DoorduinoSleep::idle(void) {
+  return SLEEP_FOREVER;
+}
+
+void DoorduinoSleep::report(void) {
+  print_P(Serial,str_wakes);
+  Serial.print(_pin_wakes);
+  print_P(Serial,str_timer);
+  Serial.print(_timer_wakes);
+  print_P(Serial,str_asleep);
+  Serial.print(_asleep);
+  print_P(Serial,str_decisions);
+  Serial.print(_decisions);
+  print_P(Serial,str_avg);
+  Serial.print(_decisions?_decision_total/_decisions:0);
+  print_P(Serial,str_worst);
+  Serial.print(_decision_worst);
+  println_P(Serial,str_ms);
+}
+
+unsigned int DoorduinoSleep::wakes(byte source) {
+  return (source==SLEEP_WAKE_PIN)?_pin_wakes:_timer_wakes;
+}
+
+/*
+** milliseconds spent powered down since boot
+*/
+unsigned long DoorduinoSleep::asleep(void) {
+  return _asleep;
+}
+
+unsigned int DoorduinoSleep::decisions(void) {
+  return _decisions;
+}
+
+unsigned long DoorduinoSleep::decision_total(void) {
+  return _decision_total;
+}
+
+unsigned long DoorduinoSleep::decision_worst(void) {
+  return _decision_worst;
+}
@@ -0,0 +1,325 @@
+/*
+** Doorduino key list sync
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+*/
+
+#include <inttypes.h>
+#include <sha256.h> // https://github.com/Cathedrow/Cryptosuite
+#include <DoorduinoTrace.h>
+#include "WProgram.h"
+#include "DoorduinoKeySync.h"
+
+static const prog_char str_getkeys[] PROGMEM = "/keys.php?since=";
+static const prog_char str_keys[] PROGMEM = "KEYS ";
+static const prog_char str_sig[] PROGMEM = "SIG ";
+
+/*
+** value of a hex digit, -1 if it is not one
+*/
+static int hexval(char c) {
+  if(c>='0' && c<='9') return c-'0';
+  if(c>='a' && c<='f') return c-'a'+10;
+  if(c>='A' && c<='F') return c-'A'+10;
+  return -1;
+}
+
+static bool parse_hex(const char *s, byte *out, byte n) {
+  for(byte i=0;i<n;i++) {
+    int hi=hexval(s[2*i]);
+    int lo=hexval(s[2*i+1]);
+    if(hi<0 || lo<0) return false;
+    out[i]=(hi<<4)|lo;
+  }
+  return true;
+}
+
+/*
+** parse a decimal number, returns a pointer past
+** its last digit or NULL if there is none
+*/
+static const char *parse_dec(const char *s, uint16_t *n) {
+  const char *start=s;
+
+  *n=0;
+  while(*s>='0' && *s<='9') {
+    *n=(*n*10)+(*s++-'0');
+  }
+  return (s==start)?NULL:s;
+}
+
+/*
+** interval is the number of iterations between syncs
+*/
+DoorduinoKeySync::DoorduinoKeySync(DoorduinoEnvironment *e, DoorduinoStore &store, PGM_P secret2, int interval) :
+  DoorduinoComponent(e),
+  _store(store)
+{
+  _secret2=secret2;
+  _interval=interval;
+  _state=SYNC_IDLE;
+  _synced=0;
+  _rejected=0;
+}
+
+unsigned int DoorduinoKeySync::synced(void) {
+  return _synced;
+}
+
+unsigned int DoorduinoKeySync::rejected(void) {
+  return _rejected;
+}
+
+/*
+** every state does a bounded amount of work and returns,
+** eeprom copies and writes stop as soon as the budget is used.
+** A request waiting for its turn keeps the net client awake.
+** Nothing syncs into an old store layout that was kept.
+*/
+int DoorduinoKeySync::idle(void) {
+  if(_store.legacy()) return SLEEP_FOREVER;
+  if(_state==SYNC_IDLE) return _timeout;
+  if(_state==SYNC_WAIT) return SLEEP_FOREVER;
+  return 0;
+}
+
+void DoorduinoKeySync::iteration(void) {
+  switch(_state) {
+    case SYNC_IDLE:
+      if(timeout() && !_store.legacy()) {
+        if(net_wait()) {
+          setTimeout(net_wait());
+          break;
+        }
+        _idx=0;
+        _changes=_store.changes();
+        _state=SYNC_COPY;
+      }
+      break;
+
+    case SYNC_COPY:
+      // deltas apply on top of the active list
+      while( (_idx<_store.capacity()) && !over_budget() ) {
+        _store.stage_copy(_idx++);
+      }
+      if(_idx==_store.capacity()) _state=SYNC_WAIT;
+      break;
+
+    case SYNC_LINE:
+      if(_line()) _state=SYNC_BODY;
+      break;
+
+    case SYNC_MAC:
+      // the expected mac replaces the chain, it is not needed anymore
+      hmac_init_P(_secret2);
+      for(int i=0;i<32;i++) {
+        Sha256.print(_chain[i]);
+      }
+      memcpy(_chain,Sha256.resultHmac(),32);
+      _diff=0;
+      _digits=0;
+      _state=SYNC_SIG;
+      break;
+
+    case SYNC_CLEAR:
+      // a snapshot replaces everything after its last key
+      while( (_idx<_store.capacity()) && !over_budget() ) {
+        _store.stage_put(_idx++,NULL,KEY_EMPTY);
+      }
+      if(_idx==_store.capacity()) _state=SYNC_COMMIT;
+      break;
+
+    case SYNC_COMMIT:
+      if(_store.changes()!=_changes) {
+        _fail(SYNC_ERR_CHANGED);
+        break;
+      }
+      _store.stage_commit(_version);
+      TRACE(TR_SYNC_COMMIT,_snapshot,_version);
+      _synced++;
+      _state=SYNC_IDLE;
+      setTimeout(_interval);
+      break;
+  }
+}
+
+bool DoorduinoKeySync::http_pending(void) {
+  return _state==SYNC_WAIT;
+}
+
+void DoorduinoKeySync::http_request(Print &out) {
+  TRACE(TR_SYNC_START,0,_store.version());
+  print_P(out,str_getkeys);
+  out.print((unsigned int)_store.version());
+
+  memset(_chain,0,sizeof(_chain));
+  _len=0;
+  _header=false;
+  _lines=0;
+  _state=SYNC_BODY;
+}
+
+bool DoorduinoKeySync::http_ready(void) {
+  return (_state==SYNC_BODY) || (_state==SYNC_SIG);
+}
+
+/*
+** collect a line, it is applied by the next iteration
+** returns false once the sync was rejected or the
+** signature is complete
+*/
+bool DoorduinoKeySync::http_body(char c) {
+  if(_state==SYNC_SIG) return _signature(c);
+
+  if(c=='\r') return true;
+  if(c=='\n') {
+    if(_len>0) _state=SYNC_LINE;
+    return true;
+  }
+  if(_len==SYNC_LINE_SIZE-1) {
+    _fail(SYNC_ERR_PARSE);
+    return false;
+  }
+  _buf[_len++]=c;
+  if( (_len==4) && (strncmp_P(_buf,str_sig,4)==0) ) {
+    if(!_header) {
+      _fail(SYNC_ERR_PARSE);
+      return false;
+    }
+    _state=SYNC_MAC;
+  }
+  return true;
+}
+
+/*
+** the request ended before the signature was checked, an
+** empty body means there is nothing new
+*/
+void DoorduinoKeySync::http_done(int status) {
+  if( (_state<SYNC_WAIT) || (_state>SYNC_SIG) ) return;
+
+  if(status==HTTP_FAILED) {
+    _fail(SYNC_ERR_NET);
+  } else if(status!=200) {
+    _fail(SYNC_ERR_STATUS);
+  } else if( (_state==SYNC_BODY) && !_header && (_len==0) ) {
+    _state=SYNC_IDLE;
+    setTimeout(_interval);
+  } else {
+    _fail(SYNC_ERR_NET);
+  }
+}
+
+/*
+** handle a complete line, it is folded into the hash chain
+** and applied to the inactive bank
+** returns false if the sync was rejected
+*/
+bool DoorduinoKeySync::_line(void) {
+  byte addr[8];
+  byte flags;
+  byte len=_len;
+
+  _len=0;
+  if(len==0) return true;
+  _buf[len]=0;
+
+  Sha256.init();
+  for(int i=0;i<32;i++) {
+    Sha256.print(_chain[i]);
+  }
+  for(byte i=0;i<len;i++) {
+    Sha256.print(_buf[i]);
+  }
+  memcpy(_chain,Sha256.result(),32);
+  _lines++;
+
+  if(!_header) {
+    const char *p;
+    uint16_t since;
+
+    if( (len<7) || (strncmp_P(_buf,str_keys,5)!=0) ) {
+      _fail(SYNC_ERR_PARSE);
+      return false;
+    }
+    p=parse_dec(_buf+5,&_version);
+    if( (p==NULL) || (*p++!=' ') ) {
+      _fail(SYNC_ERR_PARSE);
+      return false;
+    }
+    _snapshot=(*p=='S');
+    if(!_snapshot) {
+      if( (p[0]!='D') || (p[1]!=' ') || ((p=parse_dec(p+2,&since))==NULL) || (*p!=0) ) {
+        _fail(SYNC_ERR_PARSE);
+        return false;
+      }
+      if(since!=_store.version()) {
+        _fail(SYNC_ERR_VERSION);
+        return false;
+      }
+    } else if(p[1]!=0) {
+      _fail(SYNC_ERR_PARSE);
+      return false;
+    }
+    // never go back to an older list, even a correctly signed one
+    if(_version<=_store.version()) {
+      _fail(SYNC_ERR_VERSION);
+      return false;
+    }
+    _header=true;
+    _idx=0;
+    return true;
+  }
+
+  switch(_buf[0]) {
+    case '+':
+      if( (len!=19) || !parse_hex(_buf+1,addr,8) || !parse_hex(_buf+17,&flags,1) ) break;
+      if(_snapshot) {
+        if(_idx==_store.capacity()) {
+          _fail(SYNC_ERR_FULL);
+          return false;
+        }
+        _store.stage_put(_idx++,addr,flags|KEY_INUSE);
+      } else if(!_store.stage_add(addr,flags|KEY_INUSE)) {
+        _fail(SYNC_ERR_FULL);
+        return false;
+      }
+      return true;
+
+    case '-':
+      if( _snapshot || (len!=17) || !parse_hex(_buf+1,addr,8) ) break;
+      _store.stage_del(addr);
+      return true;
+  }
+  _fail(SYNC_ERR_PARSE);
+  return false;
+}
+
+/*
+** compare one hex digit of the received signature, all 64
+** are checked before deciding so timing reveals nothing
+** returns false once all have been compared
+*/
+bool DoorduinoKeySync::_signature(char c) {
+  byte b=_chain[_digits/2];
+
+  if(c>='A' && c<='F') c+='a'-'A';
+  _diff|=c^hexdigit((_digits&1)?b:(b>>4));
+  if(++_digits<64) return true;
+
+  if(_diff!=0) {
+    _fail(SYNC_ERR_SIG);
+  } else if(_snapshot) {
+    _state=SYNC_CLEAR;	// _idx continues after the last key
+  } else {
+    _state=SYNC_COMMIT;
+  }
+  return false;
+}
+
+void DoorduinoKeySync::_fail(byte reason) {
+  TRACE(TR_SYNC_REJECT,reason,_lines);
+  _rejected++;
+  _state=SYNC_IDLE;
+  setTimeout(SYNC_RETRY);
+}
@@ -0,0 +1,92 @@
+/*
+** Doorduino key list sync
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+*/
+
+#ifndef DoorduineKeySync_h
+#define DoorduineKeySync_h
+
+#include <DoorduinoComponent.h>
+#include <DoorduinoStore.h>
+#include "WProgram.h"
+
+#define SYNC_LINE_SIZE		24	// longest line is a key add, 19 chars
+#define SYNC_RETRY		300	// iterations before retrying a failed sync
+
+/*
+** response body of GET /keys.php?since=<version>, one line each
+**
+** KEYS <version> S             - snapshot, the complete key list
+** KEYS <version> D <since>     - delta against version <since>
+** +<addr, 16 hex><flags, 2 hex> - add a key or change its flags
+** -<addr, 16 hex>              - remove a key (delta only)
+** SIG <64 hex>                 - HMAC-SHA256 with secret2 over h
+**
+** h starts as 32 zero bytes and is replaced by sha256(h || line)
+** for every line before SIG, without the line end. An empty body
+** means there is nothing new.
+*/
+#define SYNC_IDLE		0
+#define SYNC_COPY		1
+#define SYNC_WAIT		2	// for the net client to run the request
+#define SYNC_BODY		3
+#define SYNC_LINE		4	// a line to apply before reading on
+#define SYNC_MAC		5	// work out the expected signature
+#define SYNC_SIG		6
+#define SYNC_CLEAR		7
+#define SYNC_COMMIT		8
+
+/*
+** reasons for rejecting a sync, reported in the trace
+*/
+#define SYNC_ERR_PARSE		1	// malformed or unexpected line
+#define SYNC_ERR_VERSION	2	// not newer than the active bank
+#define SYNC_ERR_FULL		3	// more keys than slots
+#define SYNC_ERR_SIG		4	// signature mismatch
+#define SYNC_ERR_NET		5	// connection lost or timed out
+#define SYNC_ERR_CHANGED	6	// local changes while staging
+#define SYNC_ERR_STATUS		7	// answered with another status than 200
+
+/*
+** streams the key list into the inactive store bank a line at
+** a time, and switches banks only after the signature checked
+** out. Lookups keep using the active bank the whole time. The
+** request runs in the net client, lines and the signature are
+** worked out in iteration() while the rest waits in the W5100.
+*/
+class DoorduinoKeySync : public DoorduinoComponent, public DoorduinoHttpRequest {
+  public:
+    DoorduinoKeySync(DoorduinoEnvironment *e, DoorduinoStore &store, PGM_P secret2, int interval);
+    void iteration(void);
+    int idle(void);
+    unsigned int synced(void);
+    unsigned int rejected(void);
+    bool http_pending(void);
+    void http_request(Print &out);
+    bool http_ready(void);
+    bool http_body(char c);
+    void http_done(int status);
+  private:
+    bool _line(void);
+    bool _signature(char c);
+    void _fail(byte reason);
+    DoorduinoStore &_store;
+    PGM_P _secret2;
+    int _interval;
+    int _idx;
+    char _buf[SYNC_LINE_SIZE];
+    byte _len;
+    bool _header;
+    bool _snapshot;
+    uint16_t _version;
+    unsigned int _changes;
+    unsigned int _lines;
+    uint8_t _chain[32];
+    byte _digits;
+    byte _diff;
+    unsigned int _synced;
+    unsigned int _rejected;
+};
+
+#endif
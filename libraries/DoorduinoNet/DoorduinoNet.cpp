@@ -6,17 +6,12 @@
 
 #include <inttypes.h>
 #include <Ethernet.h>
+#include <utility/w5100.h>
 #include <HTTPClient.h> // https://github.com/interactive-matter/HTTPClient/downloads
 #include <sha256.h> // https://github.com/Cathedrow/Cryptosuite
 #include "WProgram.h"
 #include "DoorduinoNet.h"
 
-#ifdef DEBUG
-#define DBG(...) Serial.print(__VA_ARGS__)
-#else
-#define DBG(...) {}
-#endif
-
 DoorduinoNet::DoorduinoNet(int ethrst_pin,uint8_t *mac, uint8_t *ip) : _server(23) {
   _mac=mac;
   _ip=ip;
@@ -32,7 +27,20 @@ void DoorduinoNet::reset(void) {
   pinMode(_rst_pin,INPUT);
   delay(200);
   Ethernet.begin(_mac,_ip);
+  W5100.setRetransmissionTime(NET_RETRY_TIME);
+  W5100.setRetransmissionCount(NET_RETRY_COUNT);
   delay(200);
   _server.begin();
 }
 
+
+/*
+** a W5100 that was reset by a glitch or a brown-out has
+** lost its address along with everything else
+*/
+bool DoorduinoNet::alive(void) {
+  uint8_t addr[4];
+
+  W5100.getIPAddress(addr);
+  return memcmp(addr,_ip,4)==0;
+}
@@ -10,10 +10,18 @@
 #include <Ethernet.h>
 #include "WProgram.h"
 
+/*
+** a connect to a host that does not answer gives up after
+** 100+200+400+800 ms instead of the W5100 default of ~30 s
+*/
+#define NET_RETRY_TIME		1000	// first retransmission after, in 100 us
+#define NET_RETRY_COUNT		3	// retransmissions before giving up
+
 class DoorduinoNet {
   public:
     DoorduinoNet(int ethr_rst_pin, uint8_t *mac, uint8_t *ip);
     void reset(void);
+    bool alive(void);
   private:
     int  _rst_pin;
     uint8_t *_mac;
@@ -6,180 +6,389 @@
 
 #include <inttypes.h>
 #include <Ethernet.h>
-#include <HTTPClient.h> // https://github.com/interactive-matter/HTTPClient/downloads
+#include <utility/w5100.h>
+#include <utility/socket.h>
 #include <sha256.h> // https://github.com/Cathedrow/Cryptosuite
+#include <DoorduinoTrace.h>
 #include "WProgram.h"
 #include "DoorduinoNet.h"
 #include "DoorduinoNetClient.h"
 
-#ifdef DEBUG
-#define DBG(...) Serial.print(__VA_ARGS__)
-#else
-#define DBG(...) {}
-#endif
+static const prog_char str_get[] PROGMEM = "GET ";
+static const prog_char str_http[] PROGMEM = " HTTP/1.0";
+static const prog_char str_logkey[] PROGMEM = "/logkey.php?key=";
+static const prog_char str_logrevoke[] PROGMEM = "/revoked.php?action=log&hash=";
+static const prog_char str_gethash[] PROGMEM = "/revoked.php?action=gethash";
+static const prog_char str_getloop[] PROGMEM = "/loop.php";
 
-DoorduinoNetClient::DoorduinoNetClient(DoorduinoEnvironment *e, DoorduinoNet net) :
+/*
+** writes into the transmit buffer of a socket, it
+** goes out in one piece with the send command
+*/
+class DoorduinoSocketPrint : public Print {
+  public:
+    DoorduinoSocketPrint(byte sock) { _sock=sock; }
+    void write(uint8_t c) { W5100.send_data_processing(_sock,&c,1); }
+    using Print::write;
+  private:
+    byte _sock;
+};
+
+/*
+** revocation_interval is the number of iterations
+** between checks of the revocation server
+*/
+DoorduinoNetClient::DoorduinoNetClient(DoorduinoEnvironment *e, DoorduinoNet &net, DoorduinoStore &store, DoorduinoAudit &audit, byte *server, PGM_P secret1, PGM_P secret2, int revocation_interval) :
   DoorduinoComponent(e),
-   _net(net)
+   _net(net),
+   _store(store),
+   _audit(audit)
 {
-  
+  _server=server;
+  _secret1=secret1;
+  _secret2=secret2;
+  _revocation_interval=revocation_interval;
+  _state=NET_IDLE;
+  _requester_count=0;
+  _current=0;
+  _pending=0;
+  _request=0;
+  add(this);
 }
 
 /*
-** send hash of key address to log server
-** returns true on success, false otherwise
+** register a component that makes http requests, they take
+** turns with the requests of the net client itself
+** returns its index, or NET_REQUESTERS when all slots are taken
 */
-bool DoorduinoNetClient::log_key(unsigned char* server, unsigned char* addr, char* secret) {
-  uint8_t* hash;
+byte DoorduinoNetClient::add(DoorduinoHttpRequest *r) {
+  if(_requester_count==NET_REQUESTERS) return NET_REQUESTERS;
 
-  Client client(server, 80);
-  
-  Sha256.init();
-  for( int i = 0; i < strlen(secret); i++) {
-    Sha256.print(secret[i]);
+  _requesters[_requester_count]=r;
+  return _requester_count++;
+}
+
+/*
+** ask the server whether the space loop is closed, the
+** answer ends up in loop_closed in the environment
+*/
+void DoorduinoNetClient::check_loop(void) {
+  _pending|=NET_REQ_LOOP;
+}
+
+void DoorduinoNetClient::iteration(void) {
+  if(_env->log_addr) {
+    _env->log_addr=false;
+    if( (_pending&NET_REQ_KEY) || (_request==NET_REQ_KEY) ) {
+      _audit.append(_env->addr);
+    } else {
+      memcpy(_key,_env->addr,8);
+      _pending|=NET_REQ_KEY;
+    }
   }
-  for(int i = 0; i < 8; i++) {
-    Sha256.print(addr[i]);
+
+  if(timeout()) {
+    setTimeout(_revocation_interval);
+    _pending|=NET_REQ_POLL;
   }
-  hash=Sha256.result(); 
-  
-  if (client.connect()) {
-    DBG("network connected\n");
-    client.print("GET /logkey.php?key=");
-    for (int i=0; i<32; i++) {
-      client.print("0123456789abcdef"[hash[i]>>4]);
-      client.print("0123456789abcdef"[hash[i]&0xf]);
-    }
-    client.println(" HTTP/1.0");
-    client.println();
-    
-    while (client.available()) {
-      char c = client.read();
-      DBG(c);
+
+  switch(_state) {
+    case NET_IDLE:
+      if(net_wait()) break;
+      for(byte i=1;i<=_requester_count;i++) {
+        byte next=(_current+i)%_requester_count;
+
+        if(_requesters[next]->http_pending()) {
+          _current=next;
+          _connect();
+          break;
+        }
+      }
+      break;
+
+    case NET_CONNECT: {
+      byte status=W5100.readSnSR(_sock);
+
+      if(status==SnSR::ESTABLISHED) {
+        _send();
+      } else if( (status==SnSR::CLOSED) || (millis()-_started>NET_TIMEOUT) ) {
+        _failed();
+      }
+      break;
     }
-    client.stop();
-    DBG("network connection closed\n");
-  } else {
-    DBG("network connection failed\n");
+
+    case NET_STATUS:
+    case NET_HEADERS:
+    case NET_BODY:
+      _receive();
+      break;
+
+    case NET_CLOSE:
+      if( (W5100.readSnSR(_sock)==SnSR::CLOSED) || (millis()-_since>NET_CLOSE_WAIT) ) {
+        close(_sock);
+        _state=NET_IDLE;
+      }
+      break;
+
+    case NET_RESET:
+      // a tick of its own, the reset pulse takes longer than a tick
+      _net.reset();
+      _env->net_resets++;
+      TRACE(TR_NET_RESET,0,_env->net_resets);
+      _state=NET_IDLE;
+      break;
   }
 }
 
-bool DoorduinoNetClient::log_revocation(byte *server, byte *addr, char *secret) {
-  uint8_t* hash;
-  
-  Client client(server, 80);
+int DoorduinoNetClient::idle(void) {
+  if( (_state!=NET_IDLE) || _env->log_addr ) return 0;
+  for(byte i=0;i<_requester_count;i++) {
+    if(_requesters[i]->http_pending()) return net_wait();
+  }
+  return _timeout;
+}
 
-  Sha256.init();
-  for( int i = 0; i < strlen(secret); i++) {
-    Sha256.print(secret[i]);
+/*
+** start connecting on the first free socket, the W5100
+** gives up by itself when the server does not answer
+*/
+void DoorduinoNetClient::_connect(void) {
+  for(_sock=0;_sock<MAX_SOCK_NUM;_sock++) {
+    if(W5100.readSnSR(_sock)==SnSR::CLOSED) break;
   }
-  for( int i = 0; i < 8; i++) {
-    Sha256.print(addr[i]);
+  _started=millis();
+  if(_sock==MAX_SOCK_NUM) {
+    _state=NET_IDLE;
+    _requesters[_current]->http_done(HTTP_FAILED);
+    return;
   }
-  hash=Sha256.result();
+  socket(_sock,SnMR::TCP,0,0);
+  ::connect(_sock,_server,NET_PORT);
+  _state=NET_CONNECT;
+}
 
-  if(client.connect()) {
-    DBG("network connected\n");
-    client.print("GET /revoked.php?action=log&hash=");
-    for (int i=0; i<32; i++) {
-      client.print("0123456789abcdef"[hash[i]>>4]);
-      client.print("0123456789abcdef"[hash[i]&0xf]);
-    }
-    client.println(" HTTP/1.0");
-    client.println();
-
-    client.stop();
-    DBG("network connection closed\n");    
-  } else {
-    DBG("network connection failed\n");
-    return false;
-  }
-  return true;
+/*
+** nothing connects for NET_BACKOFF after a failed connect. The
+** ethernet controller is only reset when it no longer knows its
+** address, a server that is down is no reason to cut off the
+** other sockets.
+*/
+void DoorduinoNetClient::_failed(void) {
+  close(_sock);
+  TRACE(TR_NET_FAILED,_current,0);
+  net_failed();
+  _state=_net.alive()?NET_IDLE:NET_RESET;
+  _requesters[_current]->http_done(HTTP_FAILED);
 }
 
+void DoorduinoNetClient::_send(void) {
+  DoorduinoSocketPrint out(_sock);
+
+  TRACE(TR_NET_CONNECTED,_current,0);
+  print_P(out,str_get);
+  _requesters[_current]->http_request(out);
+  println_P(out,str_http);
+  out.println();
+  W5100.execCmdSn(_sock,Sock_SEND);
+
+  _status=0;
+  _spaces=0;
+  _received=0;
+  _since=millis();
+  _state=NET_STATUS;
+}
 
 /*
-** check remote server for revocations and delete revoked
-** keys from eeprom
-**
-** returns:
-** true - hash (32 character array) contains the hash
-** of the key to be revoked and secret2
-** false - nothing to revoke, hash is undefined
+** consume whatever the server has sent so far. The status code
+** is the number after the first space of "HTTP/1.0 200 OK", the
+** headers end with an empty line
 */
-bool DoorduinoNetClient::get_revocation(byte *server, uint8_t *revoke_hash) {
-  byte recv_count;
-  byte state;
-  int retry=3;
-  
-  Client client(server, 80);
-
-  while(retry>0) {
-
-    if (client.connect()) {
-      DBG("network connected\n");
-      client.println("GET /revoked.php?action=gethash HTTP/1.0");
-      client.println();
-
-      recv_count=0;
-      state=0;
-      while (client.connected() && recv_count<32) {
-        // TODO: timeout to prevent DoS attack
-        if(client.available()) {
-          char c = client.read();
-          switch(state) {
-            case 0:
-              if(c=='R') state++;
-              break;
-            case 1:
-              if(c=='E') state++; else state=0;
-              break;
-            case 2:
-              if(c=='V') state++; else state=0;
-              break;
-            case 3:
-              if(c=='0') {
-                client.stop();
-                DBG("nothing to revoke");
-                return false;
-              }
-              state=4;
-              break;
-            case 4:
-              revoke_hash[recv_count++]=c;
-              break;
+void DoorduinoNetClient::_receive(void) {
+  DoorduinoHttpRequest *r=_requesters[_current];
+  uint8_t c;
+
+  while(!over_budget()) {
+    if( (_state==NET_BODY) && !r->http_ready() ) {
+      _since=millis();
+      return;
+    }
+    if( !W5100.getRXReceivedSize(_sock) || !recv(_sock,&c,1) ) break;
+
+    _received++;
+    _since=millis();
+    switch(_state) {
+      case NET_STATUS:
+        if(c=='\n') {
+          _newlines=1;
+          _state=NET_HEADERS;
+        } else if(c==' ') {
+          _spaces++;
+        } else if( (_spaces==1) && (c>='0') && (c<='9') && (_status<1000) ) {
+          _status=(_status*10)+(c-'0');
+        }
+        break;
+
+      case NET_HEADERS:
+        if(c=='\n') {
+          if(++_newlines<2) break;
+          if(_status!=200) {
+            _finish(_status);
+            return;
           }
+          _state=NET_BODY;
+        } else if(c!='\r') {
+          _newlines=0;
         }
-      }
-      client.stop();
-    
-      if(recv_count<32) {
-        DBG("nothing to revoke..\n");
-        return false;
-      }
-  
-      return true;    
-    } else {
-      DBG("network connection failed\n");
-      retry--;
-      reset();
+        break;
+
+      case NET_BODY:
+        if(!r->http_body(c)) {
+          _finish(_status);
+          return;
+        }
+        break;
     }
   }
+
+  if( (W5100.readSnSR(_sock)!=SnSR::ESTABLISHED) && !W5100.getRXReceivedSize(_sock) ) {
+    // the server closed its end, complete once the body started
+    _finish((_state==NET_BODY)?_status:HTTP_FAILED);
+  } else if( (millis()-_since>NET_TIMEOUT) || (millis()-_started>NET_REQUEST_TIME) ) {
+    TRACE(TR_NET_TIMEOUT,_current,_received);
+    _finish(HTTP_FAILED);
+  }
 }
 
-bool DoorduinoNetClient::spaceLoopClosed(char *host,byte *ip) {
-  HTTPClient client(host,ip);
+void DoorduinoNetClient::_finish(int status) {
+  disconnect(_sock);
+  TRACE(TR_NET_CLOSED,_current,_received);
+  _since=millis();
+  _state=NET_CLOSE;
+  _requesters[_current]->http_done(status);
+}
 
-  FILE *result = client.getURI("/loop.php");
+/*
+** log granted keys and periodically poll for revocations, the
+** request to make is picked here so it is known when it fails
+*/
+bool DoorduinoNetClient::http_pending(void) {
+  if( (_request==0) && _pending ) {
+    _request=_pending&-_pending;	// lowest bit goes first
+    _pending&=~_request;
+  }
+  return _request!=0;
+}
 
-  int returnCode = client.getLastReturnCode();
-  if(result!=NULL) {
-    client.closeStream(result);
-  } else {
-    DBG("failed to connect to check space loop state\n");
+void DoorduinoNetClient::http_request(Print &out) {
+  switch(_request) {
+    case NET_REQ_KEY:
+      print_P(out,str_logkey);
+      _print_hash(out,_key);
+      break;
+    case NET_REQ_REVOKED:
+      print_P(out,str_logrevoke);
+      _print_hash(out,_revoked);
+      _env->log_revocation_failed=false;
+      break;
+    case NET_REQ_POLL:
+      print_P(out,str_gethash);
+      _scan=0;
+      _count=0;
+      break;
+    case NET_REQ_LOOP:
+      print_P(out,str_getloop);
+      break;
   }
+}
 
-  if(returnCode==200) return false;
-  if(returnCode==204) return true;
+/*
+** the space loop answers with its status alone
+*/
+bool DoorduinoNetClient::http_body(char c) {
+  return (_request==NET_REQ_POLL)?_revocation(c):false;
 }
 
+/*
+** the request is over, act on what came back. A key the log
+** server did not answer 200 for goes to the audit log, a
+** failed revocation poll waits for the next interval.
+*/
+void DoorduinoNetClient::http_done(int status) {
+  byte request=_request;
+  byte addr[8];
+
+  _request=0;
+  switch(request) {
+    case NET_REQ_KEY:
+      if(status!=200) _audit.append(_key);
+      break;
+
+    case NET_REQ_REVOKED:
+      if(status!=200) _env->log_revocation_failed=true;
+      break;
+
+    case NET_REQ_POLL:
+      if( (status!=200) || (_count<32) ) {
+        TRACE(TR_NET_NO_REVOKE,_count,0);
+      } else if( _store.get_key_by_hash(_hash,_secret2,addr) &&
+                 _store.del_key(addr) ) {
+        memcpy(_revoked,addr,8);
+        _pending|=NET_REQ_REVOKED;
+      }
+      break;
+
+    case NET_REQ_LOOP:
+      if(status==HTTP_FAILED) {
+        TRACE(TR_NET_LOOP_FAILED,0,0);
+        break;
+      }
+      // only 204 says closed, errors and anything unexpected read as open
+      _env->loop_closed=(status==204);
+      if( (status!=200) && (status!=204) ) TRACE(TR_NET_LOOP_STATUS,0,status);
+      break;
+  }
+}
+
+/*
+** print the hash of a key address with secret1 as hex
+*/
+void DoorduinoNetClient::_print_hash(Print &out, byte *addr) {
+  uint8_t *hash;
+
+  Sha256.init();
+  print_P(Sha256,_secret1);
+  for(int i = 0; i < 8; i++) {
+    Sha256.print(addr[i]);
+  }
+  hash=Sha256.result();
+  print_hex(out,hash,32);
+}
+
+/*
+** find REV0 (nothing to revoke) or REV1 followed by the
+** 32 byte hash of the key to revoke
+** returns false once the answer is complete
+*/
+bool DoorduinoNetClient::_revocation(char c) {
+  switch(_scan) {
+    case 0:
+      if(c=='R') _scan++;
+      break;
+    case 1:
+      if(c=='E') _scan++; else _scan=(c=='R')?1:0;
+      break;
+    case 2:
+      if(c=='V') _scan++; else _scan=(c=='R')?1:0;
+      break;
+    case 3:
+      // only REV0 and REV1 are answers, look further for others
+      if(c=='0') return false;
+      if(c=='1') _scan=4; else _scan=(c=='R')?1:0;
+      break;
+    case 4:
+      _hash[_count++]=c;
+      if(_count==32) return false;
+      break;
+  }
+  return true;
+}
@@ -10,18 +10,84 @@
 #include <Ethernet.h>
 #include <DoorduinoComponent.h>
 #include <DoorduinoNet.h>
+#include <DoorduinoStore.h>
+#include <DoorduinoAudit.h>
 #include "WProgram.h"
 
-class DoorduinoNetClient : public DoorduinoComponent {
+#define NET_REQUESTERS		4	// components sharing the net client, itself included
+#define NET_PORT		80
+#define NET_TIMEOUT		2000	// milliseconds to connect, or between bytes of a response
+#define NET_REQUEST_TIME	10000	// milliseconds a request may take in all
+#define NET_CLOSE_WAIT		1000	// milliseconds for the server to close its end
+
+#define NET_IDLE		0
+#define NET_CONNECT		1	// the W5100 is connecting
+#define NET_STATUS		2	// status line of the response
+#define NET_HEADERS		3
+#define NET_BODY		4
+#define NET_CLOSE		5	// waiting for the server to close its end
+#define NET_RESET		6	// reset the ethernet controller, it stopped responding
+
+/*
+** requests, highest priority first
+*/
+#define NET_REQ_KEY		1	// log a granted key
+#define NET_REQ_REVOKED		2	// log a key that was revoked
+#define NET_REQ_POLL		4	// poll for revocations
+#define NET_REQ_LOOP		8	// check the space loop
+
+/*
+** runs the http requests of every registered component, one at
+** a time on one W5100 socket and in turns. Nothing waits for the
+** network: connecting and closing are polled once per iteration,
+** and what has arrived is read until the budget is used. Its own
+** requests log keys, poll for revocations and check the space
+** loop. Keys granted while one is still waiting to be logged go
+** to the audit log.
+*/
+class DoorduinoNetClient : public DoorduinoComponent, public DoorduinoHttpRequest {
   public:
-    DoorduinoNetClient(DoorduinoEnvironment *e, DoorduinoNet net);
-    void reset(void);
-    bool log_key(unsigned char* server, unsigned char* addr, char* secret);
-    bool log_revocation(byte *server, byte *addr, char *secret);
-    bool get_revocation(byte *server, uint8_t *hash);
-    bool spaceLoopClosed(char *host,byte *ip);
+    DoorduinoNetClient(DoorduinoEnvironment *e, DoorduinoNet &net, DoorduinoStore &store, DoorduinoAudit &audit, byte *server, PGM_P secret1, PGM_P secret2, int revocation_interval);
+    byte add(DoorduinoHttpRequest *r);
+    void iteration(void);
+    int idle(void);
+    void check_loop(void);
+    bool http_pending(void);
+    void http_request(Print &out);
+    bool http_body(char c);
+    void http_done(int status);
   private:
-    DoorduinoNet _net;
+    void _connect(void);
+    void _failed(void);
+    void _send(void);
+    void _receive(void);
+    void _finish(int status);
+    bool _revocation(char c);
+    void _print_hash(Print &out, byte *addr);
+    DoorduinoNet &_net;
+    DoorduinoStore &_store;
+    DoorduinoAudit &_audit;
+    byte *_server;
+    PGM_P _secret1;
+    PGM_P _secret2;
+    int _revocation_interval;
+    DoorduinoHttpRequest *_requesters[NET_REQUESTERS];
+    byte _requester_count;
+    byte _current;
+    byte _sock;
+    int _status;
+    byte _spaces;
+    byte _newlines;
+    unsigned long _received;
+    unsigned long _started;
+    unsigned long _since;
+    byte _pending;
+    byte _request;
+    byte _key[8];
+    byte _revoked[8];
+    uint8_t _hash[32];
+    byte _scan;
+    byte _count;
 };
 
 #endif
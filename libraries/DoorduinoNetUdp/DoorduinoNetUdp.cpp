@@ -0,0 +1,211 @@
+/*
+** Doorduino networking, udp datagram channel
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+*/
+
+#include <inttypes.h>
+#include <Ethernet.h>
+#include <Udp.h>
+#include <sha256.h> // https://github.com/Cathedrow/Cryptosuite
+#include <DoorduinoTrace.h>
+#include "WProgram.h"
+#include "DoorduinoNetUdp.h"
+
+DoorduinoNetUdp::DoorduinoNetUdp(DoorduinoEnvironment *e, DoorduinoStore &store, byte *server, uint16_t server_port, uint16_t local_port, PGM_P secret1, PGM_P secret2) :
+  DoorduinoComponent(e),
+  _store(store)
+{
+  _server=server;
+  _server_port=server_port;
+  _local_port=local_port;
+  _secret1=secret1;
+  _secret2=secret2;
+  _q_head=_q_count=_q_sent=0;
+  _q_seq=0;
+  _q_resync=true;
+  _boot=0;
+  _state_seq=0;
+  _dropped=0;
+  _resets=0;
+}
+
+/*
+** open the udp socket, call after the ethernet
+** interface and the key store have been initialized
+*/
+void DoorduinoNetUdp::begin(void) {
+  _boot=_store.boots();
+  Udp.begin(_local_port);
+}
+
+/*
+** queue a key address for logging, when the queue is
+** full the oldest event is dropped
+*/
+void DoorduinoNetUdp::queue_key(byte *addr) {
+  if(_q_count==UDP_LOG_QUEUE) {
+    _q_head=(_q_head+1)%UDP_LOG_QUEUE;
+    _q_count--;
+    _q_seq++;
+    _q_resync=true;
+    if(_q_sent>0) _q_sent--;
+    _dropped++;
+  }
+
+  byte slot=(_q_head+_q_count)%UDP_LOG_QUEUE;
+  for(int i=0;i<8;i++) {
+    _queue[slot][i]=addr[i];
+  }
+  _q_count++;
+}
+
+unsigned int DoorduinoNetUdp::dropped(void) {
+  return _dropped;
+}
+
+void DoorduinoNetUdp::iteration(void) {
+  // resetting the ethernet controller closed the socket
+  if(_resets!=_env->net_resets) {
+    _resets=_env->net_resets;
+    begin();
+  }
+
+  if(_env->log_addr) {
+    queue_key(_env->addr);
+    _env->log_addr=false;
+  }
+
+  _receive();
+
+  // until the server acks, it may not know this boot yet
+  if( ((_q_count>0) && (_q_sent==0)) || (((_q_count>0) || _q_resync) && timeout()) ) {
+    _send_batch();
+  }
+}
+
+/*
+** the W5100 interrupt line is not wired up, datagrams from the
+** server wait in its buffer until the next poll
+*/
+int DoorduinoNetUdp::idle(void) {
+  if( _env->log_addr || ((_q_count>0) && (_q_sent==0)) ) return 0;
+  if( ((_q_count>0) || _q_resync) && (_timeout<UDP_POLL) ) return _timeout;
+  return UDP_POLL;
+}
+
+/*
+** verify the trailing hmac of a received datagram
+*/
+bool DoorduinoNetUdp::_hmac_check(byte *buf, int len) {
+  uint8_t *hmac;
+  byte diff=0;
+
+  if(len<UDP_HASH_SIZE) return false;
+
+  hmac_init_P(_secret2);
+  for(int i=0;i<len-UDP_HASH_SIZE;i++) {
+    Sha256.print(buf[i]);
+  }
+  hmac=Sha256.resultHmac();
+  for(int i=0;i<UDP_HASH_SIZE;i++) {
+    diff|=hmac[i]^buf[len-UDP_HASH_SIZE+i];
+  }
+  return diff==0;
+}
+
+/*
+** send (or resend) a batch of the oldest queued events
+*/
+void DoorduinoNetUdp::_send_batch(void) {
+  byte buf[UDP_MAX_DATAGRAM];
+  uint8_t *hash;
+  byte count=(_q_count<UDP_LOG_BATCH)?_q_count:UDP_LOG_BATCH;
+  int len=UDP_HDR_SIZE;
+
+  buf[0]=UDP_TYPE_LOG;
+  buf[1]=_q_seq>>8;
+  buf[2]=_q_seq&0xff;
+  buf[3]=count|(_q_resync?UDP_LOG_RESYNC:0);
+  buf[4]=_boot>>8;
+  buf[5]=_boot&0xff;
+
+  for(byte n=0;n<count;n++) {
+    byte *addr=_queue[(_q_head+n)%UDP_LOG_QUEUE];
+
+    Sha256.init();
+    print_P(Sha256,_secret1);
+    for(int i = 0; i < 8; i++) {
+      Sha256.print(addr[i]);
+    }
+    hash=Sha256.result();
+    for(int i=0;i<UDP_HASH_SIZE;i++) {
+      buf[len++]=hash[i];
+    }
+  }
+
+  hmac_init_P(_secret2);
+  for(int i=0;i<len;i++) {
+    Sha256.print(buf[i]);
+  }
+  hash=Sha256.resultHmac();
+  for(int i=0;i<UDP_HASH_SIZE;i++) {
+    buf[len++]=hash[i];
+  }
+
+  Udp.sendPacket(buf,len,_server,_server_port);
+  TRACE(TR_UDP_SENT,count,_q_seq);
+
+  _q_sent=count;
+  setTimeout(UDP_RETRANSMIT);
+}
+
+/*
+** process pending datagrams from the server, acks release
+** queued log events, state pushes update the environment
+*/
+void DoorduinoNetUdp::_receive(void) {
+  byte buf[UDP_HDR_SIZE+UDP_HASH_SIZE];
+  byte ip[4];
+  uint16_t port;
+  int len;
+
+  while(Udp.available()) {
+    len=Udp.readPacket(buf,sizeof(buf),ip,&port);
+
+    if( (len!=sizeof(buf)) || (memcmp(ip,_server,4)!=0) ) continue;
+    if(!_hmac_check(buf,len)) {
+      TRACE(TR_UDP_BAD_HMAC,0,0);
+      continue;
+    }
+
+    uint16_t seq=(buf[1]<<8)|buf[2];
+
+    // answers to an earlier boot, or replayed from one
+    if( (uint16_t)((buf[4]<<8)|buf[5])!=_boot ) continue;
+
+    switch(buf[0]) {
+      case UDP_TYPE_ACK: {
+        // 0 acks nothing new but says the server is in step
+        int16_t n=(int16_t)(seq-_q_seq)+1;
+        if(n<0) break;
+        if(n>_q_count) n=_q_count;
+        _q_head=(_q_head+n)%UDP_LOG_QUEUE;
+        _q_count-=n;
+        _q_seq+=n;
+        _q_sent=(_q_sent>n)?(_q_sent-n):0;
+        _q_resync=false;
+        break;
+      }
+
+      case UDP_TYPE_STATE:
+        // ignore replayed or reordered state pushes of this boot
+        if( (_state_seq!=0) && ((int16_t)(seq-_state_seq)<=0) ) break;
+        _state_seq=seq;
+        _env->loop_closed=(buf[3]&UDP_STATE_LOOP_CLOSED)?true:false;
+        _env->space_closed=(buf[3]&UDP_STATE_SPACE_CLOSED)?true:false;
+        TRACE(TR_UDP_STATE,buf[3],seq);
+        break;
+    }
+  }
+}
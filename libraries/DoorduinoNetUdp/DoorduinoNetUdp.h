@@ -0,0 +1,89 @@
+/*
+** Doorduino networking, udp datagram channel
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+*/
+
+#ifndef DoorduineNetUdp_h
+#define DoorduineNetUdp_h
+
+#include <Udp.h>
+#include <DoorduinoComponent.h>
+#include <DoorduinoStore.h>
+#include "WProgram.h"
+
+#define UDP_LOG_QUEUE		8	// pending log events
+#define UDP_LOG_BATCH		4	// log events per datagram
+#define UDP_RETRANSMIT		20	// iterations before resending unacked batch
+#define UDP_POLL		10	// iterations between polls for datagrams while asleep
+
+#define UDP_HASH_SIZE		32
+#define UDP_HDR_SIZE		6
+#define UDP_MAX_DATAGRAM	(UDP_HDR_SIZE+UDP_LOG_BATCH*UDP_HASH_SIZE+UDP_HASH_SIZE)
+
+/*
+** datagram types, first byte of each datagram
+**
+** 'L' seq(2) count(1) boot(2) hash(32)*count hmac(32)  - log batch, board to server
+** 'A' seq(2) 0(1) boot(2) hmac(32)                     - cumulative ack, server to board
+** 'S' seq(2) flags(1) boot(2) hmac(32)                 - state push, server to board
+**
+** seq and boot are big endian; a log batch carries the sequence number
+** of its first event, an ack acknowledges all events up to and
+** including seq. boot is the boot count of the key store, the server
+** answers with the boot of the last batch it got and the board drops
+** acks and state pushes for any other boot, so ones recorded before a
+** restart cannot be replayed after it. State pushes must have a newer
+** seq than the last one of the same boot.
+** hmac is HMAC-SHA256 with secret2 over all preceding bytes.
+**
+** The board drops the oldest event when its queue is full, and starts
+** from seq 0 when it restarts. Batches sent after either have
+** UDP_LOG_RESYNC set in the count byte until an ack comes back, an
+** empty one goes out after a restart so the server learns the boot. The
+** server then takes seq as the next event instead of waiting for the
+** ones it missed. A batch whose seq is ahead of what the server
+** expects also means events were dropped. Acks that do not match the
+** queue are ignored, so a server that waits for a gap would never
+** ack anything again.
+*/
+#define UDP_TYPE_LOG		'L'
+#define UDP_TYPE_ACK		'A'
+#define UDP_TYPE_STATE		'S'
+
+#define UDP_LOG_RESYNC		0x80	// count byte: events before seq are gone
+
+#define UDP_STATE_LOOP_CLOSED	1
+#define UDP_STATE_SPACE_CLOSED	2
+
+class DoorduinoNetUdp : public DoorduinoComponent {
+  public:
+    DoorduinoNetUdp(DoorduinoEnvironment *e, DoorduinoStore &store, byte *server, uint16_t server_port, uint16_t local_port, PGM_P secret1, PGM_P secret2);
+    void begin(void);
+    void iteration(void);
+    int idle(void);
+    void queue_key(byte *addr);
+    unsigned int dropped(void);
+  private:
+    void _send_batch(void);
+    void _receive(void);
+    bool _hmac_check(byte *buf, int len);
+    DoorduinoStore &_store;
+    byte *_server;
+    uint16_t _server_port;
+    uint16_t _local_port;
+    PGM_P _secret1;
+    PGM_P _secret2;
+    byte _queue[UDP_LOG_QUEUE][8];
+    byte _q_head;
+    byte _q_count;
+    byte _q_sent;
+    uint16_t _q_seq;
+    bool _q_resync;
+    uint16_t _boot;
+    uint16_t _state_seq;
+    unsigned int _dropped;
+    byte _resets;
+};
+
+#endif
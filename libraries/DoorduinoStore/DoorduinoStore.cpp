@@ -4,13 +4,16 @@
 
 #include <EEPROM.h>
 #include <sha256.h> // https://github.com/Cathedrow/Cryptosuite
+#include <DoorduinoComponent.h>
+#include <DoorduinoTrace.h>
 #include "DoorduinoStore.h"
 
-#define KEYSTORESIZE  (E2END+1)
+#if STORE_FREE+STORE_TRAILER>E2END+1
+#error "STORE_SLOTS does not fit in the eeprom"
+#endif
 
-#define KEY_EMPTY   0
-#define KEY_INUSE   1
-#define KEY_ADMIN   2
+static const prog_char str_legacy[] PROGMEM = " keys in the old eeprom layout do not fit in ";
+static const prog_char str_legacy_off[] PROGMEM = " slots, left as they are. Key sync and audit log are off.";
 
 #ifdef DEBUG
 #define DBG(...) Serial.print(__VA_ARGS__)
@@ -18,45 +21,158 @@
 #define DBG(...) {}
 #endif
 
-DoorduinoStore::DoorduinoStore() {
-  int i;
+DoorduinoKeyCache DoorduinoStore::_cache[KEYCACHE_SIZE];
+byte DoorduinoStore::_cache_count=0;
+unsigned long DoorduinoStore::_hits=0;
+unsigned long DoorduinoStore::_misses=0;
+unsigned int DoorduinoStore::_changes=0;
+bool DoorduinoStore::_legacy=false;
 
-  i=1;
+DoorduinoStore::DoorduinoStore() {
   // noop
 }
 
+/*
+** eeprom offset of the active or the inactive bank
+*/
+int DoorduinoStore::_bank(bool active) {
+  byte sel=EEPROM.read(STORE_SELECT)&1;
+
+  if(_legacy) return 0;
+  if(!active) sel^=1;
+  return sel*STORE_BANK_SIZE;
+}
+
+/*
+** write only if the value changes, saves time and eeprom wear
+*/
+void DoorduinoStore::_update(int address, byte value) {
+  if(EEPROM.read(address)!=value) EEPROM.write(address,value);
+}
+
+/*
+** call once at boot before anything else reads the store,
+** counts the boot. An old layout with more keys than bank 0
+** holds is not migrated, that would lose keys.
+*/
+void DoorduinoStore::begin(void) {
+  uint16_t n;
+
+  if(EEPROM.read(STORE_LAYOUT)!=STORE_MAGIC) {
+    int keys=_old_keys();
+
+    _legacy=(keys>STORE_SLOTS);
+    if(_legacy) {
+      Serial.print(keys);
+      print_P(Serial,str_legacy);
+      Serial.print(STORE_SLOTS);
+      println_P(Serial,str_legacy_off);
+      TRACE(TR_STORE_LEGACY,STORE_SLOTS,keys);
+    } else {
+      _migrate();
+    }
+  }
+  n=boots()+1;
+  _update(STORE_BOOTS,n>>8);
+  _update(STORE_BOOTS+1,n&0xff);
+}
+
+/*
+** true while the old layout is kept, see DoorduinoStore.h
+*/
+bool DoorduinoStore::legacy(void) {
+  return _legacy;
+}
+
+/*
+** number of times begin() ran since the eeprom was erased
+*/
+uint16_t DoorduinoStore::boots(void) {
+  return (EEPROM.read(STORE_BOOTS)<<8)|EEPROM.read(STORE_BOOTS+1);
+}
+
+/*
+** keys in use in the old layout
+*/
+int DoorduinoStore::_old_keys(void) {
+  int n=0;
+
+  for(int idx=0;idx<STORE_OLD_SLOTS;idx++) {
+    if(EEPROM.read(idx*STORE_SLOT_SIZE)&KEY_INUSE) n++;
+  }
+  return n;
+}
+
+/*
+** convert an eeprom written with the old single bank layout,
+** begin() made sure its keys fit in bank 0.
+** Keys in slots past bank 0 move to free slots in it, the
+** version goes to 0 so the next key sync fetches the whole
+** list, and the layout byte is written last. Every step can
+** be repeated, a power cut halfway only means it starts over
+** on the next boot.
+*/
+void DoorduinoStore::_migrate(void) {
+  byte addr[8];
+  int to=0;
+
+  for(int idx=STORE_SLOTS;idx<STORE_OLD_SLOTS;idx++) {
+    int from=idx*STORE_SLOT_SIZE;
+    byte flags=EEPROM.read(from);
+
+    if(!(flags&KEY_INUSE)) continue;
+    for(int i=0;i<8;i++) {
+      addr[i]=EEPROM.read(from+1+i);
+    }
+    if(_find(0,addr)==-1) {
+      while( EEPROM.read(to*STORE_SLOT_SIZE)&KEY_INUSE ) to++;
+      for(int i=0;i<8;i++) {
+        _update(to*STORE_SLOT_SIZE+1+i,addr[i]);
+      }
+      _update(to*STORE_SLOT_SIZE,flags);
+    }
+    // empties the old slot, whatever overlaps it is rewritten below
+    _update(from,KEY_EMPTY);
+  }
+
+  _update(STORE_VERSION,0);
+  _update(STORE_VERSION+1,0);
+  for(int i=STORE_FREE;i<STORE_LAYOUT;i++) {
+    _update(i,0);
+  }
+  _update(STORE_SELECT,0);
+  EEPROM.write(STORE_LAYOUT,STORE_MAGIC);
+  _cache_count=0;
+  _changes++;
+  TRACE(TR_STORE_MIGRATE,0,STORE_SLOTS);
+}
+
 void DoorduinoStore::erase(void) {
-  DBG("Erasing eeprom, ");
-  DBG(E2END+1);
-  DBG(" bytes\n");
+  TRACE(TR_STORE_ERASE,0,E2END+1);
   for(int i=0;i<=E2END;i++) {
-    EEPROM.write(i,0);
+    EEPROM.write(i,(i==STORE_LAYOUT)?STORE_MAGIC:0);
   }
+  _cache_count=0;
+  _changes++;
+  _legacy=false;
 }
 
-bool DoorduinoStore::get_key_by_hash(uint8_t *revoke_hash,char *secret1,byte *addr) {
+bool DoorduinoStore::get_key_by_hash(uint8_t *revoke_hash,PGM_P secret1,byte *addr) {
       int idx;
       int base;
       uint8_t *hash;
       //byte addr[8];
-      bool revoked=false;
       
-      DBG("hash to revoke: ");
-      for (int i=0; i<32; i++) {
-        DBG("0123456789abcdef"[revoke_hash[i]>>4]);
-        DBG("0123456789abcdef"[revoke_hash[i]&0xf]);
-      }
-      DBG("\n");
+      TRACE(TR_STORE_REVOKE_HASH,0,TRACE_WORD(revoke_hash));
 
+      int bank=_bank(true);
       base=0; idx=0;
-      while( ((idx+1)*9) <= KEYSTORESIZE ) {
-        base=idx*9;
+      while( idx < capacity() ) {
+        base=bank+idx*STORE_SLOT_SIZE;
   
         if(EEPROM.read(base)&KEY_INUSE) {
           Sha256.init();
-          for( int i = 0; i < strlen(secret1); i++) {
-            Sha256.print(secret1[i]);
-          }
+          print_P(Sha256,secret1);
           for(int i=0;i<8;i++) {
             addr[i]=EEPROM.read(base+1+i);
             Sha256.print(addr[i]);
@@ -67,9 +183,7 @@ bool DoorduinoStore::get_key_by_hash(uint8_t *revoke_hash,char *secret1,byte *ad
             if(hash[i]!=revoke_hash[i]) match=false;
           }
           if(match) {
-            DBG("found matching key at idx ");
-            DBG(idx);
-            DBG("\n");
+            TRACE(TR_STORE_HASH_MATCH,0,idx);
             return true;
           }
         }
@@ -79,11 +193,26 @@ bool DoorduinoStore::get_key_by_hash(uint8_t *revoke_hash,char *secret1,byte *ad
 }
 
 int DoorduinoStore::find_key(byte *addr) {
+  return _find(_bank(true),addr);
+}
+
+/*
+** index of the slot holding addr in the active bank, or -1
+*/
+int DoorduinoStore::find_slot(byte *addr) {
+  int bank=_bank(true);
+  int base=_find(bank,addr);
+
+  if(base==-1) return -1;
+  return (base-bank)/STORE_SLOT_SIZE;
+}
+
+int DoorduinoStore::_find(int bank, byte *addr) {
   int idx=0;
   int base;
   
-  while( ((idx+1)*9) <= KEYSTORESIZE ) {
-    base=idx*9;
+  while( idx < capacity() ) {
+    base=bank+idx*STORE_SLOT_SIZE;
     if( EEPROM.read(base)&KEY_INUSE ) {
       int i;
       for(i=0;i<8;i++) {
@@ -98,6 +227,189 @@ int DoorduinoStore::find_key(byte *addr) {
   return -1;
 }
 
+/*
+** find_key with a small most-recently-used cache in front,
+** only keys that are found are cached
+*/
+int DoorduinoStore::lookup(byte *addr) {
+  DoorduinoKeyCache *hit=_cached(addr);
+
+  return hit?hit->base:-1;
+}
+
+/*
+** flags of a key through the cache, KEY_EMPTY if it is unknown
+*/
+byte DoorduinoStore::lookup_flags(byte *addr) {
+  DoorduinoKeyCache *hit=_cached(addr);
+
+  return hit?hit->flags:KEY_EMPTY;
+}
+
+/*
+** cache entry for addr, moved to the front, or NULL
+*/
+DoorduinoKeyCache *DoorduinoStore::_cached(byte *addr) {
+  DoorduinoKeyCache hit;
+  byte n;
+
+  for(n=0;n<_cache_count;n++) {
+    if(memcmp(_cache[n].addr,addr,8)==0) break;
+  }
+
+  if(n<_cache_count) {
+    _hits++;
+    hit=_cache[n];
+  } else {
+    _misses++;
+    hit.base=find_key(addr);
+    if(hit.base==-1) return NULL;
+    memcpy(hit.addr,addr,8);
+    hit.flags=EEPROM.read(hit.base);
+    if(_cache_count<KEYCACHE_SIZE) _cache_count++;
+    n=_cache_count-1;
+  }
+
+  // move to front, the last entry falls off when full
+  for(;n>0;n--) {
+    _cache[n]=_cache[n-1];
+  }
+  _cache[0]=hit;
+  return &_cache[0];
+}
+
+unsigned long DoorduinoStore::cache_hits(void) {
+  return _hits;
+}
+
+unsigned long DoorduinoStore::cache_misses(void) {
+  return _misses;
+}
+
+/*
+** counts local changes to the active bank, a sync that
+** sees it change while staging must not commit
+*/
+unsigned int DoorduinoStore::changes(void) {
+  return _changes;
+}
+
+void DoorduinoStore::_cache_drop(byte *addr) {
+  for(byte n=0;n<_cache_count;n++) {
+    if(memcmp(_cache[n].addr,addr,8)==0) {
+      _cache_count--;
+      for(;n<_cache_count;n++) {
+        _cache[n]=_cache[n+1];
+      }
+      return;
+    }
+  }
+}
+
+/*
+** number of key slots in the active bank
+*/
+int DoorduinoStore::capacity(void) {
+  return _legacy?STORE_OLD_SLOTS:STORE_SLOTS;
+}
+
+/*
+** flags of slot idx in the active bank, addr receives its key
+*/
+byte DoorduinoStore::get_slot(int idx, byte *addr) {
+  int base=_bank(true)+idx*STORE_SLOT_SIZE;
+
+  for(int i=0;i<8;i++) {
+    addr[i]=EEPROM.read(base+1+i);
+  }
+  return EEPROM.read(base);
+}
+
+/*
+** version of the key list in the active bank
+*/
+uint16_t DoorduinoStore::version(void) {
+  int bank=_bank(true);
+
+  // the old layout had no version, its bytes are key slots
+  if(_legacy) return 0;
+  return (EEPROM.read(bank+STORE_VERSION)<<8)|EEPROM.read(bank+STORE_VERSION+1);
+}
+
+/*
+** staging functions write the inactive bank, a sync calls
+** them a few at a time so lookups are never held up
+*/
+
+/*
+** copy slot idx of the active bank into the inactive bank
+*/
+void DoorduinoStore::stage_copy(int idx) {
+  int from=_bank(true)+idx*STORE_SLOT_SIZE;
+  int to=_bank(false)+idx*STORE_SLOT_SIZE;
+
+  for(int i=0;i<STORE_SLOT_SIZE;i++) {
+    _update(to+i,EEPROM.read(from+i));
+  }
+}
+
+/*
+** overwrite slot idx of the inactive bank, flags 0 empties it
+*/
+void DoorduinoStore::stage_put(int idx, byte *addr, byte flags) {
+  int base=_bank(false)+idx*STORE_SLOT_SIZE;
+
+  if(flags==KEY_EMPTY) {
+    _update(base,KEY_EMPTY);
+    return;
+  }
+  for(int i=0;i<8;i++) {
+    _update(base+1+i,addr[i]);
+  }
+  _update(base,flags|KEY_INUSE);
+}
+
+/*
+** add a key to the inactive bank, or update its flags
+** returns false when the bank is full
+*/
+bool DoorduinoStore::stage_add(byte *addr, byte flags) {
+  int bank=_bank(false);
+  int base=_find(bank,addr);
+
+  if(base==-1) {
+    for(int idx=0;idx<STORE_SLOTS;idx++) {
+      base=bank+idx*STORE_SLOT_SIZE;
+      if(EEPROM.read(base)==KEY_EMPTY) break;
+      base=-1;
+    }
+    if(base==-1) return false;
+  }
+  stage_put((base-bank)/STORE_SLOT_SIZE,addr,flags);
+  return true;
+}
+
+bool DoorduinoStore::stage_del(byte *addr) {
+  int base=_find(_bank(false),addr);
+
+  if(base==-1) return false;
+  _update(base,KEY_EMPTY);
+  return true;
+}
+
+/*
+** stamp the inactive bank with its version and make it active,
+** the selector is a single byte so the switch is atomic
+*/
+void DoorduinoStore::stage_commit(uint16_t version) {
+  int bank=_bank(false);
+
+  _update(bank+STORE_VERSION,version>>8);
+  _update(bank+STORE_VERSION+1,version&0xff);
+  EEPROM.write(STORE_SELECT,EEPROM.read(STORE_SELECT)^1);
+  _cache_count=0;
+}
+
 bool DoorduinoStore::check(byte *addr) {
   if(find_key(addr)==-1) return false;
   return true;
@@ -116,15 +428,14 @@ bool DoorduinoStore::add_key(byte *addr) {
   int base=find_key(addr);
   
   if( base==-1 ) {
-    DBG("Add key\n");
     int idx=0;
+    int bank=_bank(true);
     int base;
-    while( ((idx+1)*9) <= KEYSTORESIZE ) {
-      base=idx*9;
+    while( idx < capacity() ) {
+      base=bank+idx*STORE_SLOT_SIZE;
       if(EEPROM.read(base)==KEY_EMPTY) {
-        DBG("Found slot on ");
-        DBG(base);
-        DBG("\n");
+        TRACE(TR_STORE_ADD,0,base);
+        _changes++;
         EEPROM.write(base,KEY_INUSE);
         for(int i=0;i<8;i++) {
           EEPROM.write(base+1+i,addr[i]);
@@ -135,7 +446,8 @@ bool DoorduinoStore::add_key(byte *addr) {
     }
     return false;
   } else {
-    reset_admin(addr);
+    // adding a key that is already there demotes it to a normal key
+    return reset_admin(addr);
   }
 }
 
@@ -144,20 +456,23 @@ bool DoorduinoStore::del_key(byte *addr) {
   
   if(base==-1) return false;
   
+  _cache_drop(addr);
+  _changes++;
   EEPROM.write(base,KEY_EMPTY);
   for(byte i=0;i<8;i++) {
     EEPROM.write(base+1+i,0);
   }
+  return true;
 }
 
 bool DoorduinoStore::set_admin(byte *addr) {
   int base=find_key(addr);
 
-  DBG("set_admin: Found key on ");
-  DBG(base);
-  DBG("\n");
+  TRACE(TR_STORE_SET_ADMIN,0,base);
   
   if(base!=-1) {
+    _cache_drop(addr);
+    _changes++;
     EEPROM.write(base,EEPROM.read(base)|KEY_ADMIN);
     return true;
   }
@@ -168,6 +483,8 @@ bool DoorduinoStore::reset_admin(byte addr[8]) {
   int base=find_key(addr);
   
   if(base!=-1) {
+    _cache_drop(addr);
+    _changes++;
     EEPROM.write(base,EEPROM.read(base)&(~KEY_ADMIN));
     return true;
   }
@@ -175,7 +492,9 @@ bool DoorduinoStore::reset_admin(byte addr[8]) {
 }
 
 void DoorduinoStore::dump(void) {
-  for(int i=0;i<KEYSTORESIZE;i+=9) {
+  int bank=_bank(true);
+
+  for(int i=bank;i<bank+capacity()*STORE_SLOT_SIZE;i+=STORE_SLOT_SIZE) {
       DBG(i);
       DBG(":");
       for( int j = 0; j < 9; j++) {
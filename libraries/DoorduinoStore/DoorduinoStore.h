@@ -7,14 +7,81 @@
 #ifndef DoorduineStore_h
 #define DoorduineStore_h
 
+#include <avr/pgmspace.h>
 #include "WProgram.h"
 
+#define KEY_EMPTY   0
+#define KEY_INUSE   1
+#define KEY_ADMIN   2
+#define KEY_CLASS   0x1c	// schedule class, bits 2-4
+#define KEY_CLASS_SHIFT 2
+
+/*
+** eeprom layout, two banks of key slots followed by a 16 bit
+** version each, a boot counter, a layout byte and a selector
+** in the last byte.
+** Lookups use the active bank while a key list sync fills the
+** other one, flipping the selector switches banks atomically.
+** Bank 0 starts at 0 so its slots match the old single bank.
+** The bytes between the banks and the trailer are left for
+** other users such as the audit log, fewer key slots leave
+** them more room. The default leaves 1/8 of the eeprom.
+**
+** The old layout filled the eeprom with slots and never wrote
+** its last bytes, begin() moves its keys into bank 0 when the
+** layout byte is not STORE_MAGIC. When they do not fit it leaves
+** the eeprom alone and says so at every boot: legacy() is true,
+** the store works on all STORE_OLD_SLOTS old slots like the old
+** firmware did, and key list sync and the audit log stay off as
+** they would overwrite keys. Deleting keys until they fit in
+** STORE_SLOTS, or erasing, migrates on the next boot.
+*/
+#define STORE_SLOT_SIZE	9
+#define STORE_TRAILER	8	// boot counter, layout byte, selector and the audit cursor
+#ifndef STORE_SLOTS
+#define STORE_SLOTS	((E2END+1-STORE_TRAILER-(E2END+1)/8)/(2*STORE_SLOT_SIZE))	// key slots per bank
+#endif
+#define STORE_VERSION	(STORE_SLOTS*STORE_SLOT_SIZE)
+#define STORE_BANK_SIZE	(STORE_VERSION+2)
+#define STORE_FREE	(2*STORE_BANK_SIZE)	// first byte after the banks
+#define STORE_BOOTS	(E2END-3)
+#define STORE_LAYOUT	(E2END-1)
+#define STORE_SELECT	E2END
+
+#define STORE_MAGIC	0xd2	// layout byte of the two bank layout
+#define STORE_OLD_SLOTS	((E2END+1)/STORE_SLOT_SIZE)	// slots of the old layout
+
+#define KEYCACHE_SIZE	4	// recently granted keys kept in ram
+
+typedef struct {
+  byte addr[8];
+  int base;
+  byte flags;
+} DoorduinoKeyCache;
+
 class DoorduinoStore {
   public:
     DoorduinoStore();
+    void begin(void);
     void erase(void);
-    bool get_key_by_hash(uint8_t *revoke_hash,char *secret1,byte *addr);
+    uint16_t boots(void);
+    bool legacy(void);
+    bool get_key_by_hash(uint8_t *revoke_hash,PGM_P secret1,byte *addr);
     int find_key(byte *addr);
+    int find_slot(byte *addr);
+    int lookup(byte *addr);
+    byte lookup_flags(byte *addr);
+    int capacity(void);
+    byte get_slot(int idx, byte *addr);
+    uint16_t version(void);
+    void stage_copy(int idx);
+    void stage_put(int idx, byte *addr, byte flags);
+    bool stage_add(byte *addr, byte flags);
+    bool stage_del(byte *addr);
+    void stage_commit(uint16_t version);
+    unsigned long cache_hits(void);
+    unsigned long cache_misses(void);
+    unsigned int changes(void);
     bool check(byte *addr);
     bool is_admin(byte *addr);
     bool add_key(byte *addr);
@@ -23,6 +90,20 @@ class DoorduinoStore {
     bool reset_admin(byte *addr);
     void dump(void);
   private:
+    int _old_keys(void);
+    void _migrate(void);
+    int _bank(bool active);
+    int _find(int bank, byte *addr);
+    void _update(int address, byte value);
+    DoorduinoKeyCache *_cached(byte *addr);
+    void _cache_drop(byte *addr);
+    // shared by all copies, there is only one eeprom
+    static DoorduinoKeyCache _cache[KEYCACHE_SIZE];
+    static byte _cache_count;
+    static unsigned long _hits;
+    static unsigned long _misses;
+    static unsigned int _changes;
+    static bool _legacy;
 };
 
 #endif
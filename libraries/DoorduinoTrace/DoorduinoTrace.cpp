@@ -0,0 +1,96 @@
+/*
+** Doorduino binary trace buffer
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+*/
+
+#include "DoorduinoTrace.h"
+
+// without DEBUG nothing records, the sketch has no trace then
+#ifdef DEBUG
+
+DoorduinoTraceRecord DoorduinoTrace::_ring[TRACE_SIZE];
+byte DoorduinoTrace::_head=0;
+byte DoorduinoTrace::_count=0;
+unsigned int DoorduinoTrace::_lost=0;
+
+DoorduinoTrace::DoorduinoTrace(DoorduinoEnvironment *e) : DoorduinoComponent(e) {
+}
+
+/*
+** append a record, when the buffer is full the new record
+** is counted as lost and reported once there is room again
+*/
+void DoorduinoTrace::record(uint8_t id, uint8_t a, uint32_t b) {
+  uint8_t sreg=SREG;
+
+  cli();
+  if(_count==TRACE_SIZE) {
+    _lost++;
+  } else {
+    DoorduinoTraceRecord *r=&_ring[(_head+_count)%TRACE_SIZE];
+    r->id=id;
+    r->a=a;
+    r->time=millis();
+    r->b=b;
+    _count++;
+  }
+  SREG=sreg;
+}
+
+/*
+** stay awake until the ring buffer is drained
+*/
+int DoorduinoTrace::idle(void) {
+  return (_count || _lost)?0:SLEEP_FOREVER;
+}
+
+void DoorduinoTrace::_write(DoorduinoTraceRecord *r) {
+  byte *p=(byte*)r;
+  byte sum=0;
+
+  Serial.write(TRACE_SYNC);
+  for(byte i=0;i<sizeof(DoorduinoTraceRecord);i++) {
+    Serial.write(p[i]);
+    sum+=p[i];
+  }
+  Serial.write(sum);
+}
+
+/*
+** drain records until the buffer is empty or the scheduler
+** budget for this tick has no room for another one
+*/
+void DoorduinoTrace::iteration(void) {
+  DoorduinoTraceRecord r;
+
+  while(!over_budget(TRACE_FRAME_US)) {
+    uint8_t sreg=SREG;
+    cli();
+    if(_count==0) {
+      SREG=sreg;
+      break;
+    }
+    r=_ring[_head];
+    _head=(_head+1)%TRACE_SIZE;
+    _count--;
+    SREG=sreg;
+
+    _write(&r);
+  }
+
+  if( (_lost>0) && !over_budget(TRACE_FRAME_US) ) {
+    uint8_t sreg=SREG;
+    cli();
+    r.b=_lost;
+    _lost=0;
+    SREG=sreg;
+
+    r.id=TR_TRACE_LOST;
+    r.a=0;
+    r.time=millis();
+    _write(&r);
+  }
+}
+
+#endif
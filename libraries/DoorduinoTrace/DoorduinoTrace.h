@@ -0,0 +1,102 @@
+/*
+** Doorduino binary trace buffer
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+*/
+
+#ifndef DoorduineTrace_h
+#define DoorduineTrace_h
+
+#include <DoorduinoComponent.h>
+#include "WProgram.h"
+
+#define TRACE_SIZE		16	// records in ring buffer
+#define TRACE_SYNC		0xa5	// frame marker on the serial line
+#define TRACE_BAUD		9600	// as set up by the sketch
+
+/*
+** a record goes out framed as TRACE_SYNC, the record and the
+** 8 bit sum of the record bytes
+*/
+#define TRACE_FRAME		(sizeof(DoorduinoTraceRecord)+2)
+#define TRACE_FRAME_US		(TRACE_FRAME*10*1000000UL/TRACE_BAUD)
+
+/*
+** event ids, the comment after each id is the format string
+** used by tools/trace_decode.py: {a} and {b} are the record
+** arguments, {s} is b as a signed value
+*/
+#define TR_AUTH_SCAN		1	// R[{a}]={b:08x}
+#define TR_AUTH_CRC		2	// CRC is not valid!
+#define TR_AUTH_SCHEDULE	3	// key of class {a} refused in hour {b}
+#define TR_STORE_ERASE		10	// Erasing eeprom, {b} bytes
+#define TR_STORE_REVOKE_HASH	11	// hash to revoke: {b:08x}..
+#define TR_STORE_HASH_MATCH	12	// found matching key at idx {b}
+#define TR_STORE_ADD		13	// Add key, found slot on {s}
+#define TR_STORE_SET_ADMIN	14	// set_admin: Found key on {s}
+#define TR_STORE_MIGRATE	15	// old key store layout moved to {b} slots
+#define TR_STORE_LEGACY		16	// old key store layout kept, {b} keys do not fit in {a} slots
+#define TR_NET_CONNECTED	20	// network connected
+#define TR_NET_CLOSED		21	// network request {a} closed, {b} bytes received
+#define TR_NET_FAILED		22	// network connection failed, request {a}
+#define TR_NET_NO_REVOKE	23	// nothing to revoke ({a})
+#define TR_NET_TIMEOUT		24	// network request {a} timed out after {b} bytes
+#define TR_NET_LOOP_FAILED	25	// failed to connect to check space loop state
+#define TR_NET_LOOP_STATUS	26	// space loop state answered with status {b}
+#define TR_NET_RESET		27	// ethernet controller stopped responding, reset number {b}
+#define TR_UDP_SENT		30	// udp log batch sent, seq {b} count {a}
+#define TR_UDP_BAD_HMAC		31	// udp datagram with bad hmac
+#define TR_UDP_STATE		32	// udp state push, flags {a} seq {b}
+#define TR_SCHED_OVERRUN	40	// overrun task {a}: {b}us
+#define TR_SYNC_START		50	// key sync from version {b}
+#define TR_SYNC_COMMIT		51	// key sync committed version {b}, snapshot {a}
+#define TR_SYNC_REJECT		52	// key sync rejected, reason {a} after {b} lines
+#define TR_AUDIT_UPLOAD		60	// audit log uploaded {a} events, cursor {b}
+#define TR_AUDIT_FAILED		61	// audit log upload failed, status {b}
+#define TR_AUDIT_DROPPED	62	// audit log full, dropped record at {b}
+#define TR_CLOCK_SET		70	// clock set to {b}s into the week, hour {a}
+#define TR_CLOCK_FAILED		71	// clock sync failed ({a})
+#define TR_TRACE_LOST		255	// {b} trace records lost
+
+/*
+** fixed size record, little endian as written by the avr
+*/
+typedef struct {
+  uint8_t id;
+  uint8_t a;
+  uint16_t time;	// millis(), low 16 bits
+  uint32_t b;
+} DoorduinoTraceRecord;
+
+#ifdef DEBUG
+#define TRACE(id,a,b) DoorduinoTrace::record((id),(a),(b))
+#else
+#define TRACE(id,a,b) {}
+#endif
+
+/*
+** pack 4 bytes big endian so hex output keeps byte order
+*/
+#define TRACE_WORD(p) ( ((uint32_t)(p)[0]<<24) | ((uint32_t)(p)[1]<<16) | ((uint32_t)(p)[2]<<8) | (p)[3] )
+
+/*
+** records are written to a ram ring buffer and drained to
+** the serial port from iteration(). Serial.write() waits for
+** each byte to go out, so a record is only started when the
+** budget has room for all of it.
+*/
+class DoorduinoTrace : public DoorduinoComponent {
+  public:
+    DoorduinoTrace(DoorduinoEnvironment *e);
+    static void record(uint8_t id, uint8_t a, uint32_t b);
+    void iteration(void);
+    int idle(void);
+  private:
+    static void _write(DoorduinoTraceRecord *r);
+    static DoorduinoTraceRecord _ring[TRACE_SIZE];
+    static byte _head;
+    static byte _count;
+    static unsigned int _lost;
+};
+
+#endif
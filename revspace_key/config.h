@@ -1,24 +1,59 @@
-// debug output
-#undef DEBUG
+// debug output is switched in DoorduinoConfig.h, the libraries
+// are compiled on their own and do not see this file
 
 // define to wipe eeprom and program 1st admin key
 #undef SETUP
 
+// power down between ticks while nothing is going on, keys
+// and buttons wake the board through pin change interrupts
+#undef LOW_POWER
+
 // network setup
 byte mac[] = { 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF };	// our mac address
 byte ip[] = { 10, 0, 6, 66 };				// our ip
 byte server[] = { 10, 0, 23, 42 }; 			// server ip
 
-// shared secrets for server communication
-char secret1[]="some very long sentence";
-char secret2[]="some other very long sentence";
+// shared secrets for server communication, kept in flash
+const prog_char secret1[] PROGMEM = "some very long sentence";
+const prog_char secret2[] PROGMEM = "some other very long sentence";
+
+// udp datagram channel for access logs and loop state push,
+// replaces the per-event http log request when defined
+#undef USE_UDP
+#define UDP_LOCAL_PORT  5001
+#define UDP_SERVER_PORT 5001
 
 // seconds between checking revocation server
 #define CHECK_REVOCATION  60
 
+// seconds between fetching the signed key list from the server
+#define KEY_SYNC  300
+
+// seconds between setting the clock from the time server
+#define CLOCK_SYNC  1800
+
+// weekly access schedules for key classes 1-7 (flag bits 2-4 in
+// the key list), class 0 keys may always enter. Keys with a
+// schedule are refused until the clock has been set.
+const prog_uchar schedules[][SCHEDULE_BYTES] PROGMEM = {
+  WEEKDAYS(HOURS(8,18)),	// class 1: contractors, weekdays 8:00-18:00
+};
+
 // delays
 #define OPEN_DELAY  4000
 
+// per-tick time budgets (microseconds), overruns are counted
+// and reported by the scheduler. All of them together fit in
+// one scheduler tick, the sketch checks
+#define AUTH_BUDGET 15000	// a onewire search
+#define UDP_BUDGET  10000
+#define NET_BUDGET  20000
+#define SYNC_BUDGET 25000
+#define AUDIT_BUDGET 10000
+#define CLOCK_BUDGET 8000	// the hmac over a time answer
+#define TRACE_BUDGET 11000	// one trace record at 9600 baud
+#define SLEEP_BUDGET 1000
+
 #ifdef DEBUG
 #define FAIL_DELAY 3000
 #else
@@ -30,6 +30,8 @@
 #include <Ethernet.h>
 #include <HTTPClient.h> // https://github.com/interactive-matter/HTTPClient/downloads
 #include <sha256.h>  // https://github.com/Cathedrow/Cryptosuite
+#include <DoorduinoConfig.h> // DEBUG, shared with the libraries
+#include <DoorduinoClock.h> // schedule macros used in config.h
 #include "config.h"  // configuration options
 
 #define VERSION "4"
@@ -41,24 +43,50 @@
 #endif
 
 #include <DoorduinoComponent.h>
+#include <DoorduinoTrace.h>
 #include <DoorduinoNet.h>
+#include <DoorduinoNetClient.h>
 #include <DoorduinoStore.h>
 #include <DoorduinoGpio.h>
 #include <DoorduinoAuth.h>
+#include <DoorduinoKeySync.h>
+#include <DoorduinoAudit.h>
+#ifdef USE_UDP
+#include <Udp.h>
+#include <DoorduinoNetUdp.h>
+#endif
+
+#if AUTH_BUDGET+UDP_BUDGET+NET_BUDGET+SYNC_BUDGET+AUDIT_BUDGET+CLOCK_BUDGET+TRACE_BUDGET+SLEEP_BUDGET > SCHED_TICK*1000L
+#error "the task budgets in config.h add up to more than a scheduler tick"
+#endif
 
 DoorduinoEnvironment env = {
   false, false, false,
   { 0,0,0,0,0,0,0,0 },
   false,
-  { 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0 },
-  false, false, false, false
+  false, false, false, false,
+  0,
+  0,
+  0
 };
   
 
 DoorduinoNet net(ethrst_pin,mac,ip);
 DoorduinoStore store;
 DoorduinoGpio gpio(r_pin,g_pin,b_pin,strike_pin);
-DoorduinoAuth auth(&env, store, gpio, onewire_pin);
+DoorduinoClock weekclock(&env, store, secret2, CLOCK_SYNC*(1000/SCHED_TICK));
+DoorduinoAuth auth(&env, store, gpio, weekclock, schedules[0], sizeof(schedules)/SCHEDULE_BYTES, onewire_pin);
+DoorduinoAudit audit(&env, store, weekclock, secret1);
+DoorduinoNetClient netclient(&env, net, store, audit, server, secret1, secret2, CHECK_REVOCATION*(1000/SCHED_TICK));
+DoorduinoKeySync keysync(&env, store, secret2, KEY_SYNC*(1000/SCHED_TICK));
+#ifdef USE_UDP
+DoorduinoNetUdp udp(&env, store, server, UDP_SERVER_PORT, UDP_LOCAL_PORT, secret1, secret2);
+#endif
+#ifdef DEBUG
+DoorduinoTrace trace(&env);
+#endif
+DoorduinoSleep powersave(&env);
+DoorduinoScheduler sched;
 
 /*
 ** set pin modes and start serial output
@@ -77,10 +105,45 @@ void setup(void) {
   pinMode(b_pin,OUTPUT);
   pinMode(strike_pin,OUTPUT);
   Serial.begin(9600);
-  Serial.write("Initialized version ");
-  Serial.write(VERSION);
-  Serial.write("..\n");
+  print_P(Serial,PSTR("Initialized version " VERSION "..\n"));
+  store.begin();
+#ifdef USE_UDP
+  udp.begin();
+#endif
   store.dump();
+
+#ifndef SETUP
+  audit.begin();
+  sched.add(&auth, AUTH_BUDGET);
+#ifdef USE_UDP
+  sched.add(&udp, UDP_BUDGET);
+#endif
+  // logs granted keys over http unless udp took them first, and
+  // polls for revocations. Runs the requests of the components
+  // added to it too, one at a time on one socket. Connects and
+  // closes are polled so a slow or dead server does not hold up
+  // the tick.
+  netclient.add(&keysync);
+  netclient.add(&audit);
+  netclient.add(&weekclock);
+  sched.add(&netclient, NET_BUDGET);
+  sched.add(&keysync, SYNC_BUDGET);
+  sched.add(&audit, AUDIT_BUDGET);
+  sched.add(&weekclock, CLOCK_BUDGET);
+#ifdef DEBUG
+  sched.add(&trace, TRACE_BUDGET);
+#endif
+  sched.add(&powersave, SLEEP_BUDGET);
+  powersave.wake_on(onewire_pin);	// presence pulse of a key touching the reader
+  powersave.wake_on(add_pin);
+  powersave.wake_on(add_admin_pin);
+  powersave.wake_on(revoke_pin);
+#ifdef LOW_POWER
+  sched.sleep_with(&powersave);
+#endif
+  sched.begin();
+  sched.report();
+#endif
 }
   
 #ifdef SETUP
@@ -142,13 +205,8 @@ void loop(void) {
     env.s2=true;
   }
   
-  auth.iteration();
-  
-  // netclient.iteration();
-  
-  // netserver.iteration();
-
-  delay(100);
+  // runs auth, netclient, netserver, ..
+  sched.tick();
 }
 
 #endif
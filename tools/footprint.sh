@@ -0,0 +1,51 @@
+#!/bin/sh
+#
+# Doorduino footprint report
+# (c) 2011, "Koen Martens" <gmc@revspace.nl>
+# Released under LGPL3
+#
+# Reports .text/.data/.bss per library from the object files the
+# Arduino IDE leaves in its build directory. Enable verbose output
+# during compilation in the IDE preferences to see where that is
+# (usually /tmp/buildNNNN.tmp), then:
+#
+#   tools/footprint.sh /tmp/build1234.tmp
+#
+# .data + .bss is what a library costs in SRAM, .text + .data in flash.
+#
+
+SIZE=${AVR_SIZE:-avr-size}
+BUILD=${1%/}
+
+if [ -z "$BUILD" ] || [ ! -d "$BUILD" ]; then
+  echo "usage: $0 <arduino build directory>" >&2
+  exit 1
+fi
+
+# map each object to the source directory it was compiled from,
+# the IDE puts the objects of a library in a directory named after
+# it (with utility/ below that) and those of the core and sketch at
+# the top. The sketch is the one whose .cpp the IDE generated here.
+find "$BUILD" -name '*.o' | while read obj; do
+  rel=${obj#"$BUILD"/}
+  src=${obj%.o}
+  case "$rel" in
+    */*) group=${rel%%/*} ;;
+    *)   if [ -f "$src" ] || [ -f "$src.cpp" ]; then group=sketch; else group=core; fi ;;
+  esac
+  $SIZE "$obj" | awk -v group="$group" 'NR>1 { print group, $1, $2, $3 }'
+done | awk '
+  { text[$1]+=$2; data[$1]+=$3; bss[$1]+=$4 }
+  END {
+    printf "%-24s %8s %8s %8s %8s\n", "library", ".text", ".data", ".bss", "sram"
+    for (g in text) {
+      printf "%-24s %8d %8d %8d %8d\n", g, text[g], data[g], bss[g], data[g]+bss[g]
+      t+=text[g]; d+=data[g]; b+=bss[g]
+    }
+    printf "%-24s %8d %8d %8d %8d\n", "total (before linking)", t, d, b, d+b
+  }'
+
+# the linked image is what actually has to fit
+for elf in "$BUILD"/*.elf; do
+  if [ -f "$elf" ]; then $SIZE "$elf"; fi
+done
@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+#
+# Doorduino http stand-in server
+# (c) 2011, "Koen Martens" <gmc@revspace.nl>
+# Released under LGPL3
+#
+# Answers the board's http requests in place of the log server, slowed
+# down or made hostile by a netload script (see tools/sim/netload.cpp),
+# to load test a real board on the bench:
+#
+#   http_standin.py --port 80 tools/sim/loads/faults.load
+#
+# Prints the requests started, completed and failed per minute for each
+# phase of the script. Revocation polls are always answered REV0.
+#
+
+import argparse
+import socket
+import socketserver
+import threading
+import time
+
+lock = threading.Lock()
+phase = {}
+counts = {}
+
+
+def parse(path):
+    phases, end = [], None
+    for lineno, line in enumerate(open(path), 1):
+        words = line.split('#')[0].split()
+        if not words:
+            continue
+        if len(words) < 2:
+            raise SystemExit('%s:%d: cannot parse setting' % (path, lineno))
+        when, name, value = float(words[0]), words[1], (int(words[2]) if len(words) > 2 else 0)
+        if name == 'end':
+            end = when
+        else:
+            phases.append((when, name, value))
+    return phases, end if end is not None else phases[-1][0] + 60
+
+
+def apply(settings, name, value):
+    if name == 'normal':
+        settings.update(up=True, status=0, byte_time=0, endless=False, hang=False, drop=False, partial=0)
+    elif name == 'throttle':
+        settings['byte_time'] = 1.0 / value if value else 0
+    elif name == 'trickle':
+        settings.update(byte_time=value / 1000.0, endless=True)
+    elif name in ('down', 'up'):
+        settings['up'] = name == 'up'
+    elif name in ('hang', 'drop'):
+        settings[name] = True
+    else:
+        settings[name] = value
+
+
+def count(what):
+    with lock:
+        counts[what] = counts.get(what, 0) + 1
+
+
+class Handler(socketserver.BaseRequestHandler):
+    def handle(self):
+        with lock:
+            s = dict(phase)
+        conn = self.request
+        count('started')
+        if not s['up']:
+            # reset instead of an answer, the closest to a refused connect
+            conn.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, b'\1\0\0\0\0\0\0\0')
+            count('failed')
+            return
+
+        request = b''
+        conn.settimeout(10)
+        try:
+            while b'\r\n\r\n' not in request and b'\n\n' not in request:
+                data = conn.recv(512)
+                if not data:
+                    return
+                request += data
+            time.sleep(s['latency'] / 1000.0)
+            if s['drop']:
+                return
+            if s['hang']:
+                conn.settimeout(None)
+                while conn.recv(512):
+                    pass
+                return
+
+            path = request.split(b' ')[1] if b' ' in request else b''
+            status = s['status'] or 200
+            body = b''
+            if path.startswith(b'/loop.php'):
+                status = s['status'] or s['loop']
+            elif b'action=gethash' in path:
+                body = b'REV0'
+            if status != 200:
+                body = b'error\n' if status != 204 else b''
+            if s['partial']:
+                body = body[:s['partial']]
+
+            for b in b'HTTP/1.0 %d X\r\n\r\n' % status + body:
+                conn.sendall(bytes([b]))
+                time.sleep(s['byte_time'])
+            while s['endless']:
+                conn.sendall(b'x')
+                time.sleep(s['byte_time'])
+            count('completed')
+        except OSError:
+            pass
+
+
+def main():
+    ap = argparse.ArgumentParser(description='Doorduino http stand-in server')
+    ap.add_argument('script')
+    ap.add_argument('--listen', default='0.0.0.0')
+    ap.add_argument('--port', type=int, default=80)
+    ap.add_argument('--latency', type=int, default=20, help='ms before answering')
+    ap.add_argument('--loop', type=int, default=204, help='/loop.php status')
+    args = ap.parse_args()
+
+    phases, end = parse(args.script)
+    apply(phase, 'normal', 0)
+    phase.update(latency=args.latency, loop=args.loop)
+
+    socketserver.ThreadingTCPServer.allow_reuse_address = True
+    server = socketserver.ThreadingTCPServer((args.listen, args.port), Handler)
+    server.daemon_threads = True
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+
+    start = time.time()
+    print('%7s %7s  %-16s %9s %9s %9s' % ('from s', 'to s', 'setting', 'req/min', 'done/min', 'fail/min'))
+    for i, (when, name, value) in enumerate(phases):
+        until = phases[i + 1][0] if i + 1 < len(phases) else end
+        time.sleep(max(0, start + when - time.time()))
+        with lock:
+            apply(phase, name, value)
+            counts.clear()
+        time.sleep(max(0, start + until - time.time()))
+        if until > when:
+            with lock:
+                minutes = (until - when) / 60
+                print('%7.1f %7.1f  %-16s %9.1f %9.1f %9.1f' % (
+                    when, until, (name + ' ' + str(value)) if value else name,
+                    counts.get('started', 0) / minutes, counts.get('completed', 0) / minutes,
+                    counts.get('failed', 0) / minutes), flush=True)
+    server.shutdown()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,626 @@
+/*
+** Doorduino host simulator
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+**
+** Replays traces into the real sketch and libraries under a
+** virtual clock and reports, per scenario, how fast the door
+** decides, how often the auth state machine moves, how much
+** eeprom and network traffic that takes and which tasks ran over
+** their budget.
+**
+**   doorsim [-v] [-p] [-s serial.out] scenario.trace [more.trace ..]
+**
+** -p runs the board in low power mode, see DoorduinoSleep. Sleep
+** lasts until the watchdog or a touch or button event wakes it.
+** -s writes what the board sends to its serial port to a file,
+** built with DEBUG that is the trace for tools/trace_decode.py.
+**
+** Trace lines are "<seconds> <event> [args]", # starts a comment:
+**
+**   0      key 01a2b3c4d5e6f7 [admin]   provision a key before boot
+**   12.5   touch 01a2b3c4d5e6f7 [hold] [granted|denied|undecided]
+**                                       iButton on the reader, hold in s,
+**                                       and the outcome it must have
+**   30     button add|revoke|admin [hold]
+**   40     door open|closed             reed switch (not used by the sketch yet)
+**   50     server up|down
+**   50     server latency <ms>
+**   50     server loop 200|204
+**   50     server clock mon|tue|..|sun <hh:mm>  time server answers, it is now that
+**   60     revoke 01a2b3c4d5e6f7        server offers this key for revocation
+**   70     list add 01a2b3c4d5e6f7 [admin] [class <n>]  change the key list
+**   70     list del 01a2b3c4d5e6f7          the server syncs, each change is a new version
+**   3600   end                          stop here instead of after the last event
+**
+** Buttons are the pins of that name in config.h, the sketch reads
+** revoke_pin as button 3 and add_admin_pin as button 2.
+** Addresses of 14 hex digits get their crc byte appended.
+** Each scenario runs in its own process so it starts from a
+** freshly booted board. A scenario fails when a touch has another
+** outcome than the one given for it, or when the watchdog would
+** have reset the board.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "WProgram.h"
+#include <OneWire.h>
+#include <sha256.h>
+#include <DoorduinoStore.h>
+#include <DoorduinoAuth.h>
+#include <DoorduinoKeySync.h>
+#include <DoorduinoAudit.h>
+#include <DoorduinoClock.h>
+#include <DoorduinoComponent.h>
+#include "sim.h"
+
+// pins, timing and secrets as configured for the board
+namespace cfg {
+#include "config.h"
+}
+
+#define DECISION_GRACE	2000000	// us after release before a touch counts as undecided
+
+void setup(void);
+void loop(void);
+extern DoorduinoAuth auth;
+extern DoorduinoStore store;
+extern DoorduinoKeySync keysync;
+extern DoorduinoAudit audit;
+extern DoorduinoClock weekclock;
+extern DoorduinoSleep powersave;
+extern DoorduinoScheduler sched;
+
+enum { OUT_NONE, OUT_GRANTED, OUT_DENIED, OUT_UNDECIDED };
+
+static const char *outcomes[]={ "", "granted", "denied", "undecided" };
+
+enum { EV_KEY, EV_TOUCH, EV_RELEASE, EV_BUTTON, EV_BUTTON_UP, EV_DOOR, EV_SERVER_UP,
+       EV_SERVER_DOWN, EV_LATENCY, EV_LOOP, EV_CLOCK, EV_REVOKE, EV_LIST_ADD, EV_LIST_DEL, EV_EXPIRE, EV_END };
+
+typedef struct {
+  int type;
+  uint8_t addr[8];
+  uint8_t pin;
+  bool admin;
+  long value;
+  int line;
+} Event;
+
+typedef std::multimap<uint64_t,Event> Schedule;
+
+static bool verbose=false;
+static bool low_power=false;
+
+// the scenario, events up to next have been applied
+static Schedule events;
+static Schedule::iterator next;
+static uint64_t start;
+
+// decision tracking for the touch currently on the reader, a touch
+// is armed once the auth state machine picked it up (state 17)
+static bool pending=false;
+static bool armed=false;
+static uint64_t touch_time;
+static int touch_id=0;
+static std::vector<double> latencies;
+static unsigned long granted, denied, undecided;
+
+// outcomes given in the scenario, by touch
+static std::map<int,int> expected;
+static unsigned long mismatches;
+
+// key list on the server, address -> flags
+static std::map<std::string,uint8_t> keylist;
+
+static void outcome(int id, int got) {
+  std::map<int,int>::iterator e=expected.find(id);
+
+  if( (e==expected.end()) || (e->second==got) ) return;
+  mismatches++;
+  printf("%12.3f touch %d %s, expected %s\n",sim_now/1e6,id,outcomes[got],outcomes[e->second]);
+}
+
+static void pin_hook(uint8_t pin, uint8_t val) {
+  if(!armed) return;
+
+  if( (pin==strike_pin) && (val==HIGH) ) {
+    granted++;
+  } else if( (pin==r_pin) && (val==LOW) && (auth.state()==21) ) {
+    denied++;
+  } else {
+    return;
+  }
+  pending=armed=false;
+  outcome(touch_id,(pin==strike_pin)?OUT_GRANTED:OUT_DENIED);
+  latencies.push_back((sim_now-touch_time)/1000.0);
+  if(verbose) {
+    printf("%12.3f touch %d %s after %.1f ms\n",sim_now/1e6,touch_id,
+           (pin==strike_pin)?"granted":"denied",latencies.back());
+  }
+}
+
+static bool parse_addr(const char *s, uint8_t *addr) {
+  size_t len=strlen(s);
+
+  if( (len!=14) && (len!=16) ) return false;
+  for(size_t i=0;i<len/2;i++) {
+    unsigned int b;
+    if(sscanf(s+i*2,"%2x",&b)!=1) return false;
+    addr[i]=b;
+  }
+  if(len==14) addr[7]=OneWire::crc8(addr,7);
+  return true;
+}
+
+static uint8_t button_pin(const char *name) {
+  if(!strcmp(name,"add")) return add_pin;
+  if(!strcmp(name,"revoke")) return revoke_pin;
+  if(!strcmp(name,"admin")) return add_admin_pin;
+  return 0;
+}
+
+static bool parse(const char *file, Schedule &events) {
+  FILE *f=fopen(file,"r");
+  char line[256];
+  int lineno=0;
+
+  if(!f) {
+    perror(file);
+    return false;
+  }
+
+  while(fgets(line,sizeof(line),f)) {
+    char *argv[7]={ NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+    int argc=0;
+    Event ev;
+    double t;
+    uint64_t when;
+
+    lineno++;
+    if(char *hash=strchr(line,'#')) *hash=0;
+    for(char *tok=strtok(line," \t\r\n");tok && argc<7;tok=strtok(NULL," \t\r\n")) {
+      argv[argc++]=tok;
+    }
+    if(argc==0) continue;
+
+    memset(&ev,0,sizeof(ev));
+    ev.line=lineno;
+    if( (argc<2) || (sscanf(argv[0],"%lf",&t)!=1) ) goto bad;
+    when=(uint64_t)(t*1e6);
+
+    if(!strcmp(argv[1],"key") && argc>=3) {
+      ev.type=EV_KEY;
+      if(!parse_addr(argv[2],ev.addr)) goto bad;
+      ev.admin=(argc>=4) && !strcmp(argv[3],"admin");
+      when=0;
+    } else if(!strcmp(argv[1],"touch") && argc>=3) {
+      ev.type=EV_TOUCH;
+      if(!parse_addr(argv[2],ev.addr)) goto bad;
+      double hold=0.5;
+      int expect=OUT_NONE;
+      for(int i=3;i<argc;i++) {
+        for(expect=OUT_UNDECIDED;expect>OUT_NONE && strcmp(argv[i],outcomes[expect]);expect--);
+        if(expect!=OUT_NONE) {
+          if(i+1!=argc) goto bad;
+        } else if( (i!=3) || (sscanf(argv[i],"%lf",&hold)!=1) ) {
+          goto bad;
+        }
+      }
+      Event up=ev;
+      up.type=EV_RELEASE;
+      events.insert(std::make_pair(when+(uint64_t)(hold*1e6),up));
+      up.type=EV_EXPIRE;
+      up.value=++touch_id;
+      events.insert(std::make_pair(when+(uint64_t)(hold*1e6)+DECISION_GRACE,up));
+      ev.value=touch_id;
+      if(expect!=OUT_NONE) expected[touch_id]=expect;
+    } else if(!strcmp(argv[1],"button") && argc>=3) {
+      ev.type=EV_BUTTON;
+      ev.pin=button_pin(argv[2]);
+      if(!ev.pin) goto bad;
+      double hold=(argc>=4)?atof(argv[3]):0.3;
+      Event up=ev;
+      up.type=EV_BUTTON_UP;
+      events.insert(std::make_pair(when+(uint64_t)(hold*1e6),up));
+    } else if(!strcmp(argv[1],"door") && argc>=3) {
+      ev.type=EV_DOOR;
+      ev.value=!strcmp(argv[2],"open");
+    } else if(!strcmp(argv[1],"server") && argc>=3) {
+      if(!strcmp(argv[2],"up")) ev.type=EV_SERVER_UP;
+      else if(!strcmp(argv[2],"down")) ev.type=EV_SERVER_DOWN;
+      else if(!strcmp(argv[2],"latency") && argc>=4) { ev.type=EV_LATENCY; ev.value=atol(argv[3]); }
+      else if(!strcmp(argv[2],"loop") && argc>=4) { ev.type=EV_LOOP; ev.value=atol(argv[3]); }
+      else if(!strcmp(argv[2],"clock") && argc>=5) {
+        static const char *days[]={ "mon", "tue", "wed", "thu", "fri", "sat", "sun" };
+        int day, hh, mm;
+        for(day=0;day<7 && strcmp(argv[3],days[day]);day++);
+        if( (day==7) || (sscanf(argv[4],"%d:%d",&hh,&mm)!=2) ) goto bad;
+        ev.type=EV_CLOCK;
+        ev.value=day*86400+hh*3600+mm*60;
+      }
+      else goto bad;
+    } else if(!strcmp(argv[1],"revoke") && argc>=3) {
+      ev.type=EV_REVOKE;
+      if(!parse_addr(argv[2],ev.addr)) goto bad;
+    } else if(!strcmp(argv[1],"list") && argc>=4) {
+      if(!strcmp(argv[2],"add")) ev.type=EV_LIST_ADD;
+      else if(!strcmp(argv[2],"del")) ev.type=EV_LIST_DEL;
+      else goto bad;
+      if(!parse_addr(argv[3],ev.addr)) goto bad;
+      for(int i=4;i<argc;i++) {
+        if(!strcmp(argv[i],"admin")) ev.admin=true;
+        else if(!strcmp(argv[i],"class") && i+1<argc) ev.value=atol(argv[++i]);
+        else goto bad;
+      }
+    } else if(!strcmp(argv[1],"end")) {
+      ev.type=EV_END;
+    } else {
+      goto bad;
+    }
+    events.insert(std::make_pair(when,ev));
+    continue;
+
+  bad:
+    fprintf(stderr,"%s:%d: cannot parse event\n",file,lineno);
+    fclose(f);
+    return false;
+  }
+  fclose(f);
+  return true;
+}
+
+/*
+** hash the server would hand out to revoke a key
+*/
+static std::string revocation_hash(uint8_t *addr) {
+  Sha256.init();
+  print_P(Sha256,cfg::secret2);
+  for(int i=0;i<8;i++) Sha256.print(addr[i]);
+  return std::string((char*)Sha256.result(),32);
+}
+
+/*
+** signed snapshot of the server key list, see DoorduinoKeySync.h
+*/
+static std::string keylist_body(unsigned int version) {
+  std::vector<std::string> lines;
+  uint8_t chain[32];
+  char buf[64];
+  std::string body;
+
+  snprintf(buf,sizeof(buf),"KEYS %u S",version);
+  lines.push_back(buf);
+  for(std::map<std::string,uint8_t>::iterator i=keylist.begin();i!=keylist.end();i++) {
+    std::string line="+";
+    for(int b=0;b<8;b++) {
+      snprintf(buf,sizeof(buf),"%02x",(uint8_t)i->first[b]);
+      line+=buf;
+    }
+    snprintf(buf,sizeof(buf),"%02x",i->second);
+    lines.push_back(line+buf);
+  }
+
+  memset(chain,0,sizeof(chain));
+  for(size_t i=0;i<lines.size();i++) {
+    Sha256.init();
+    for(int b=0;b<32;b++) Sha256.print(chain[b]);
+    Sha256.print(lines[i].c_str());
+    memcpy(chain,Sha256.result(),32);
+    body+=lines[i]+"\n";
+  }
+  Sha256.initHmac((const uint8_t*)cfg::secret2,strlen(cfg::secret2));
+  for(int b=0;b<32;b++) Sha256.print(chain[b]);
+  uint8_t *sig=Sha256.resultHmac();
+  body+="SIG ";
+  for(int b=0;b<32;b++) {
+    snprintf(buf,sizeof(buf),"%02x",sig[b]);
+    body+=buf;
+  }
+  return body+"\n";
+}
+
+/*
+** signed /time.php body, see DoorduinoClock.h
+*/
+static std::string time_body(unsigned long nonce, unsigned long seconds) {
+  char buf[32];
+  std::string body;
+
+  Sha256.initHmac((const uint8_t*)cfg::secret2,strlen(cfg::secret2));
+  Sha256.print(nonce);
+  Sha256.print(' ');
+  Sha256.print(seconds);
+  uint8_t *mac=Sha256.resultHmac();
+  snprintf(buf,sizeof(buf),"%lu ",seconds);
+  body=buf;
+  for(int b=0;b<32;b++) {
+    snprintf(buf,sizeof(buf),"%02x",mac[b]);
+    body+=buf;
+  }
+  return body+"\n";
+}
+
+/*
+** events take effect at the start of the next tick, when
+** is the time they happened at and latency is measured from
+*/
+static void apply(const Event &ev, uint64_t when) {
+  switch(ev.type) {
+    case EV_TOUCH:
+      if(pending) {
+        undecided++;
+        outcome(touch_id,OUT_UNDECIDED);
+      }
+      memcpy(sim_ibutton_addr,ev.addr,8);
+      sim_ibutton=true;
+      pending=true;
+      armed=false;
+      touch_time=when;
+      touch_id=ev.value;
+      break;
+    case EV_RELEASE:
+      sim_ibutton=false;
+      break;
+    case EV_EXPIRE:
+      if(pending && (touch_id==ev.value)) {
+        pending=armed=false;
+        undecided++;
+        outcome(touch_id,OUT_UNDECIDED);
+        if(verbose) printf("%12.3f touch %ld undecided\n",sim_now/1e6,ev.value);
+      }
+      break;
+    case EV_BUTTON:
+      sim_pins[ev.pin]=LOW;
+      break;
+    case EV_BUTTON_UP:
+      sim_pins[ev.pin]=HIGH;
+      break;
+    case EV_DOOR:
+      sim_pins[door_sensor_pin]=ev.value?HIGH:LOW;
+      break;
+    case EV_SERVER_UP:
+      sim_server.up=true;
+      break;
+    case EV_SERVER_DOWN:
+      sim_server.up=false;
+      break;
+    case EV_LATENCY:
+      sim_server.latency=ev.value;
+      break;
+    case EV_LOOP:
+      sim_server.loop_status=ev.value;
+      break;
+    case EV_CLOCK:
+      sim_server.clock=true;
+      sim_server.week_offset=(ev.value+604800-(sim_now/1000000)%604800)%604800;
+      break;
+    case EV_REVOKE: {
+      uint8_t addr[8];
+      memcpy(addr,ev.addr,8);
+      sim_server.revocations.push_back(revocation_hash(addr));
+      break;
+    }
+    case EV_LIST_ADD:
+    case EV_LIST_DEL: {
+      std::string addr((const char*)ev.addr,8);
+      if(ev.type==EV_LIST_ADD) keylist[addr]=(ev.admin?KEY_ADMIN:0)|(ev.value<<KEY_CLASS_SHIFT);
+      else keylist.erase(addr);
+      sim_server.keys=keylist_body(++sim_server.keys_version);
+      break;
+    }
+  }
+}
+
+/*
+** power down: events that happen while asleep are applied as
+** they come, the first one that changes a pin with its pin
+** change interrupt enabled wakes the board up
+*/
+static uint64_t sleep_hook(uint64_t us, int *pin) {
+  uint64_t from=sim_now;
+
+  for(;next!=events.end() && start+next->first<=from+us;next++) {
+    const Event &ev=next->second;
+
+    if(ev.type==EV_KEY) continue;
+    sim_now=std::max(sim_now,start+next->first);
+    apply(ev,start+next->first);
+    if( (ev.type==EV_TOUCH) && sim_wakes_on(onewire_pin) ) {
+      *pin=onewire_pin;		// presence pulse of the key
+    } else if( ((ev.type==EV_BUTTON) || (ev.type==EV_BUTTON_UP)) && sim_wakes_on(ev.pin) ) {
+      *pin=ev.pin;
+    }
+    if(*pin>=0) {
+      next++;
+      return sim_now-from;
+    }
+  }
+  sim_now=from+us;
+  return us;
+}
+
+static double average(const std::vector<double> &v) {
+  double sum=0;
+  if(v.empty()) return 0;
+  for(size_t i=0;i<v.size();i++) sum+=v[i];
+  return sum/v.size();
+}
+
+static double percentile(std::vector<double> v, double p) {
+  if(v.empty()) return 0;
+  std::sort(v.begin(),v.end());
+  return v[(size_t)(p*(v.size()-1))];
+}
+
+static double wallclock(void) {
+  struct timeval tv;
+  gettimeofday(&tv,NULL);
+  return tv.tv_sec+tv.tv_usec/1e6;
+}
+
+static int run(const char *file) {
+  std::map<int,unsigned long> entered;
+  unsigned long transitions=0;
+  unsigned long ticks=0;
+  uint64_t longest_tick=0;
+
+  if(!parse(file,events)) return 1;
+
+  uint64_t end=events.empty()?0:events.rbegin()->first+5000000;
+  for(Schedule::iterator i=events.begin();i!=events.end();i++) {
+    if(i->second.type==EV_END) {
+      end=i->first;
+      break;
+    }
+  }
+
+  for(int i=0;i<SIM_PINS;i++) sim_pins[i]=HIGH;
+  sim_pins[door_sensor_pin]=LOW;
+
+  // provisioned keys go in before the board boots
+  next=events.begin();
+  for(;next!=events.end() && next->first==0;next++) {
+    if(next->second.type!=EV_KEY) continue;
+    uint8_t addr[8];
+    memcpy(addr,next->second.addr,8);
+    store.add_key(addr);
+    if(next->second.admin) store.set_admin(addr);
+  }
+  next=events.begin();
+
+  double wall=wallclock();
+  setup();
+  sim_reset_stats();
+  sim_pin_hook=pin_hook;
+  sim_server.time_body=time_body;
+  if(low_power) {
+    sched.sleep_with(&powersave);
+    sim_sleep_hook=sleep_hook;
+  }
+  unsigned long hits=store.cache_hits();
+  unsigned long misses=store.cache_misses();
+  start=sim_now;
+  int state=auth.state();
+
+  while(sim_now<end) {
+    for(;next!=events.end() && next->first<=sim_now-start;next++) {
+      if(next->second.type!=EV_KEY) apply(next->second,start+next->first);
+    }
+
+    uint64_t t0=sim_now;
+    uint64_t asleep=sim_stats.asleep;
+    loop();
+    ticks++;
+    longest_tick=std::max(longest_tick,sim_now-t0-(sim_stats.asleep-asleep));
+
+    if(auth.state()!=state) {
+      state=auth.state();
+      if(pending && (state==17)) armed=true;
+      transitions++;
+      entered[state]++;
+    }
+  }
+  if(pending) {
+    undecided++;
+    outcome(touch_id,OUT_UNDECIDED);
+  }
+  wall=wallclock()-wall;
+
+  double simulated=(sim_now-start)/1e6;
+  printf("scenario %s\n",file);
+  printf("  simulated      %.1f s in %.2f s (%.0fx real time), %lu ticks, longest %.1f ms\n",
+         simulated,wall,simulated/(wall>0?wall:1e-9),ticks,longest_tick/1000.0);
+  printf("  touches        %lu granted, %lu denied, %lu undecided",granted,denied,undecided);
+  if(!expected.empty()) printf(", %lu of %zu not as expected",mismatches,expected.size());
+  printf("\n");
+  printf("  latency ms     min %.1f  avg %.1f  p50 %.1f  p95 %.1f  max %.1f\n",
+         percentile(latencies,0),
+         average(latencies),
+         percentile(latencies,0.5),percentile(latencies,0.95),percentile(latencies,1));
+  printf("  transitions    %lu:",transitions);
+  for(std::map<int,unsigned long>::iterator i=entered.begin();i!=entered.end();i++) {
+    printf(" %d=%lu",i->first,i->second);
+  }
+  printf("\n");
+  printf("  eeprom         %lu reads, %lu writes\n",sim_stats.eeprom_reads,sim_stats.eeprom_writes);
+  printf("  key cache      %lu hits, %lu misses\n",store.cache_hits()-hits,store.cache_misses()-misses);
+  printf("  onewire        %lu searches\n",sim_stats.searches);
+  printf("  sha256         %lu blocks\n",sim_stats.sha_blocks);
+  printf("  network        %lu requests, %lu failed\n",sim_stats.requests,sim_stats.failed);
+  printf("  key sync       %u synced, %u rejected, store version %u\n",
+         keysync.synced(),keysync.rejected(),store.version());
+  if(weekclock.hour()==CLOCK_UNSET) printf("  clock          not set\n");
+  else printf("  clock          hour %u of the week\n",weekclock.hour());
+  printf("  audit log      %u events uploaded, %u dropped, %u bytes pending\n",
+         audit.uploaded(),audit.dropped(),audit.pending());
+  printf("  overruns      ");
+  for(byte i=0;i<SCHED_MAX_COMPONENTS;i++) {
+    if(sched.overruns(i)) printf(" task %u %ux worst %.1f ms",i,sched.overruns(i),sched.worst(i)/1000.0);
+  }
+  printf("\n");
+  printf("  serial         %lu bytes\n",sim_stats.serial_bytes);
+  printf("  watchdog       %lu expired, longest unfed %.1f ms\n",
+         sim_stats.wdt_expired,sim_stats.wdt_longest/1000.0);
+  if(low_power) {
+    printf("  sleep          %.1f%% asleep, %u pin wakes, %u timer wakes, millis off by %ld ms\n",
+           100.0*sim_stats.asleep/(sim_now-start),
+           powersave.wakes(SLEEP_WAKE_PIN),powersave.wakes(SLEEP_WAKE_TIMER),
+           (long)(millis()-sim_now/1000));
+    printf("  wake to decide %u decisions, avg %.1f ms, worst %lu ms\n",powersave.decisions(),
+           powersave.decisions()?(double)powersave.decision_total()/powersave.decisions():0.0,
+           powersave.decision_worst());
+  }
+  return (mismatches || sim_stats.wdt_expired)?1:0;
+}
+
+int main(int argc, char **argv) {
+  int opt;
+  int status=0;
+
+  while((opt=getopt(argc,argv,"vps:"))!=-1) {
+    switch(opt) {
+      case 'v': verbose=true; break;
+      case 'p': low_power=true; break;
+      case 's':
+        if(!(sim_serial=fopen(optarg,"wb"))) {
+          perror(optarg);
+          return 2;
+        }
+        break;
+      default:
+        fprintf(stderr,"usage: %s [-v] [-p] [-s serial.out] scenario.trace ..\n",argv[0]);
+        return 2;
+    }
+  }
+  if(optind>=argc) {
+    fprintf(stderr,"usage: %s [-v] [-p] [-s serial.out] scenario.trace ..\n",argv[0]);
+    return 2;
+  }
+
+  for(int i=optind;i<argc;i++) {
+    int rc;
+
+    fflush(stdout);
+    pid_t pid=fork();
+    if(pid==0) {
+      rc=run(argv[i]);
+      fflush(stdout);
+      if(sim_serial) fflush(sim_serial);
+      _exit(rc);
+    }
+    waitpid(pid,&rc,0);
+    if(!WIFEXITED(rc) || WEXITSTATUS(rc)) status=1;
+  }
+  return status;
+}
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+#
+# Doorduino synthetic trace generator
+# (c) 2011, "Koen Martens" <gmc@revspace.nl>
+# Released under LGPL3
+#
+# Writes a doorsim trace with a realistic mix: a few regulars account
+# for most openings, members mostly come in the evening, the odd unknown
+# key, revocations and log server outages.
+#
+#   gentrace.py --days 7 --members 60 > week.trace
+#
+
+import argparse
+import random
+
+
+def crc8(data):
+    crc = 0
+    for b in data:
+        for _ in range(8):
+            mix = (crc ^ b) & 1
+            crc >>= 1
+            if mix:
+                crc ^= 0x8c
+            b >>= 1
+    return crc
+
+
+def address(n):
+    body = bytes([0x01]) + n.to_bytes(6, 'big')
+    return (body + bytes([crc8(body)])).hex()
+
+
+def main():
+    ap = argparse.ArgumentParser(description='Doorduino synthetic trace generator')
+    ap.add_argument('--days', type=float, default=7)
+    ap.add_argument('--members', type=int, default=60)
+    ap.add_argument('--visits', type=float, default=40, help='door openings per day')
+    ap.add_argument('--unknown', type=float, default=0.02, help='fraction of touches by unknown keys')
+    ap.add_argument('--outages', type=int, default=2, help='log server outages')
+    ap.add_argument('--revocations', type=int, default=1)
+    ap.add_argument('--seed', type=int, default=1)
+    args = ap.parse_args()
+
+    rnd = random.Random(args.seed)
+    end = args.days * 86400
+    members = [address(0xa10000 + i) for i in range(args.members)]
+    # zipf-like popularity, regulars first
+    weights = [1.0 / (i + 1) for i in range(args.members)]
+    events = []
+
+    print('# synthetic: %g days, %d members, %g visits/day, seed %d'
+          % (args.days, args.members, args.visits, args.seed))
+    print('0\tkey %s admin' % members[0])
+    for m in members[1:]:
+        print('0\tkey %s' % m)
+
+    t = 0.0
+    while True:
+        # busier in the evening, almost nothing at night
+        hour = (t / 3600) % 24
+        rate = args.visits / 86400 * (3.0 if 18 <= hour < 24 else 1.0 if 10 <= hour < 18 else 0.1)
+        t += rnd.expovariate(rate * 1.6)
+        if t >= end:
+            break
+        if rnd.random() < args.unknown:
+            who = address(0xff0000 + rnd.randrange(1000))
+        else:
+            who = rnd.choices(members, weights)[0]
+        events.append((t, 'touch %s %.1f' % (who, rnd.uniform(0.2, 1.5))))
+        events.append((t + rnd.uniform(2, 6), 'door open'))
+        events.append((t + rnd.uniform(8, 20), 'door closed'))
+
+    for _ in range(args.outages):
+        start = rnd.uniform(0, end)
+        events.append((start, 'server down'))
+        events.append((start + rnd.uniform(600, 7200), 'server up'))
+
+    for m in rnd.sample(members[1:], min(args.revocations, len(members) - 1)):
+        events.append((rnd.uniform(0, end), 'revoke %s' % m))
+
+    for t, ev in sorted(events):
+        print('%.3f\t%s' % (t, ev))
+    print('%.3f\tend' % end)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,693 @@
+/*
+** Doorduino host simulator, arduino shims
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+*/
+
+#include <string.h>
+#include "WProgram.h"
+#include "EEPROM.h"
+#include "OneWire.h"
+#include "Ethernet.h"
+#include "utility/w5100.h"
+#include "utility/socket.h"
+#include "Udp.h"
+#include "HTTPClient.h"
+#include <avr/wdt.h>
+#include <avr/sleep.h>
+#include <avr/interrupt.h>
+#include "sim.h"
+
+uint64_t sim_now=0;
+uint8_t sim_pins[SIM_PINS];
+void (*sim_pin_hook)(uint8_t pin, uint8_t val)=NULL;
+bool sim_ibutton=false;
+uint8_t sim_ibutton_addr[8];
+SimServer sim_server={ true, 20, 204 };
+SimStats sim_stats;
+std::deque<SimDatagram> sim_datagrams;
+bool sim_wedged=false;
+uint64_t (*sim_sleep_hook)(uint64_t us, int *pin)=NULL;
+FILE *sim_serial=NULL;
+uint64_t sim_delay_end=0;
+uint64_t sim_delay_us=0;
+
+uint8_t SREG=0;
+uint8_t MCUSR=0;
+uint8_t WDTCSR=0;
+uint8_t PCICR=0;
+uint8_t PCIFR=0;
+uint8_t PCMSK0=0;
+uint8_t PCMSK1=0;
+uint8_t PCMSK2=0;
+
+// timer0 stops while powered down, millis() loses that time
+// until the sketch adds it back to timer0_millis
+volatile unsigned long timer0_millis=0;
+static uint64_t sim_stopped=0;
+
+HardwareSerial Serial;
+EEPROMClass EEPROM;
+EthernetClass Ethernet;
+W5100Class W5100;
+UdpClass Udp;
+
+static uint8_t eeprom[E2END+1];
+
+void sim_advance(uint64_t us) {
+  sim_now+=us;
+}
+
+void sim_reset_stats(void) {
+  memset(&sim_stats,0,sizeof(sim_stats));
+}
+
+/*
+** time
+*/
+
+unsigned long millis(void) {
+  return (sim_now-sim_stopped)/1000+timer0_millis;
+}
+
+unsigned long micros(void) {
+  return sim_now-sim_stopped;
+}
+
+void delay(unsigned long ms) {
+  sim_advance((uint64_t)ms*1000);
+  sim_delay_end=sim_now;
+  sim_delay_us=(uint64_t)ms*1000;
+}
+
+void delayMicroseconds(unsigned int us) {
+  sim_advance(us);
+}
+
+/*
+** pins, inputs float high (pull-ups), buttons pull them low
+*/
+
+void pinMode(uint8_t pin, uint8_t mode) {
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  if(pin>=SIM_PINS) return;
+  if(sim_pin_hook) sim_pin_hook(pin,val);
+}
+
+int digitalRead(uint8_t pin) {
+  if(pin>=SIM_PINS) return LOW;
+  return sim_pins[pin];
+}
+
+/*
+** watchdog, a reset is counted instead of done when the time
+** since it was last fed outlasts the period. Interrupt mode,
+** as used while asleep, never resets
+*/
+static uint64_t wdt_fed;
+
+static void wdt_check(void) {
+  int p=(WDTCSR&7)|((WDTCSR&_BV(WDP3))?8:0);
+  uint64_t unfed=sim_now-wdt_fed;
+
+  if(!(WDTCSR&_BV(WDE))) return;
+  if(unfed>sim_stats.wdt_longest) sim_stats.wdt_longest=unfed;
+  if(unfed>(16000ULL<<p)) sim_stats.wdt_expired++;
+}
+
+void wdt_enable(int timeout) {
+  WDTCSR=_BV(WDE)|(timeout&7)|((timeout&8)?_BV(WDP3):0);
+  wdt_fed=sim_now;
+}
+
+void wdt_reset(void) {
+  wdt_check();
+  wdt_fed=sim_now;
+}
+
+void wdt_disable(void) {
+  wdt_check();
+  WDTCSR=0;
+}
+
+/*
+** power down until the watchdog period is over or a pin with
+** its pin change interrupt enabled changes, then run the isr
+*/
+bool sim_wakes_on(uint8_t pin) {
+  if(pin<8) return (PCICR&_BV(PCIE2)) && (PCMSK2&_BV(pin));
+  if(pin<14) return (PCICR&_BV(PCIE0)) && (PCMSK0&_BV(pin-8));
+  if(pin<20) return (PCICR&_BV(PCIE1)) && (PCMSK1&_BV(pin-14));
+  return false;
+}
+
+void sleep_cpu(void) {
+  int p=(WDTCSR&7)|((WDTCSR&_BV(WDP3))?8:0);
+  uint64_t period=16000ULL<<p;
+  uint64_t slept=period;
+  int pin=-1;
+
+  if(sim_sleep_hook) slept=sim_sleep_hook(period,&pin);
+  else sim_advance(period);
+  sim_stopped+=slept;
+  sim_stats.asleep+=slept;
+
+  if(pin<0) WDT_vect();
+  else if(pin<8) PCINT2_vect();
+  else if(pin<14) PCINT0_vect();
+  else PCINT1_vect();
+}
+
+/*
+** serial output goes to sim_serial or nowhere, its time is
+** charged either way
+*/
+
+void HardwareSerial::begin(long baud) {
+}
+
+void HardwareSerial::write(uint8_t c) {
+  sim_stats.serial_bytes++;
+  if(sim_serial) putc(c,sim_serial);
+  sim_advance(COST_SERIAL_BYTE);
+}
+
+/*
+** print, same semantics as arduino-0022
+*/
+
+void Print::write(const char *s) {
+  while(*s) write((uint8_t)*s++);
+}
+
+void Print::write(const uint8_t *buf, size_t size) {
+  while(size--) write(*buf++);
+}
+
+void Print::print(const char s[]) { write(s); }
+void Print::print(char c, int base) { print((long)c,base); }
+void Print::print(unsigned char b, int base) { print((unsigned long)b,base); }
+void Print::print(int n, int base) { print((long)n,base); }
+void Print::print(unsigned int n, int base) { print((unsigned long)n,base); }
+
+void Print::print(long n, int base) {
+  if(base==0) {
+    write((uint8_t)n);
+  } else if(base==10 && n<0) {
+    print('-');
+    printNumber(-n,10);
+  } else {
+    printNumber(n,base);
+  }
+}
+
+void Print::print(unsigned long n, int base) {
+  if(base==0) write((uint8_t)n);
+  else printNumber(n,base);
+}
+
+void Print::println(void) { print('\r'); print('\n'); }
+void Print::println(const char s[]) { print(s); println(); }
+void Print::println(char c, int base) { print(c,base); println(); }
+void Print::println(unsigned char b, int base) { print(b,base); println(); }
+void Print::println(int n, int base) { print(n,base); println(); }
+void Print::println(unsigned int n, int base) { print(n,base); println(); }
+void Print::println(long n, int base) { print(n,base); println(); }
+void Print::println(unsigned long n, int base) { print(n,base); println(); }
+
+void Print::printNumber(unsigned long n, uint8_t base) {
+  char buf[8*sizeof(long)];
+  int i=0;
+
+  if(n==0) {
+    print('0');
+    return;
+  }
+  while(n>0) {
+    buf[i++]=n%base;
+    n/=base;
+  }
+  for(;i>0;i--) {
+    print((char)(buf[i-1]<10?'0'+buf[i-1]:'A'+buf[i-1]-10));
+  }
+}
+
+/*
+** eeprom
+*/
+
+uint8_t EEPROMClass::read(int address) {
+  sim_stats.eeprom_reads++;
+  sim_advance(COST_EEPROM_READ);
+  return eeprom[address];
+}
+
+void EEPROMClass::write(int address, uint8_t value) {
+  sim_stats.eeprom_writes++;
+  sim_advance(COST_EEPROM_WRITE);
+  eeprom[address]=value;
+}
+
+/*
+** onewire
+*/
+
+OneWire::OneWire(uint8_t pin) {
+  _last_device=false;
+}
+
+uint8_t OneWire::search(uint8_t *addr) {
+  sim_stats.searches++;
+  if(!sim_ibutton || _last_device) {
+    _last_device=false;
+    sim_advance(COST_ONEWIRE_EMPTY);
+    return false;
+  }
+  memcpy(addr,sim_ibutton_addr,8);
+  _last_device=true;
+  sim_advance(COST_ONEWIRE_SEARCH);
+  return true;
+}
+
+void OneWire::reset_search(void) {
+  _last_device=false;
+}
+
+uint8_t OneWire::crc8(uint8_t *addr, uint8_t len) {
+  uint8_t crc=0;
+
+  while(len--) {
+    uint8_t inbyte=*addr++;
+    for(uint8_t i=8;i;i--) {
+      uint8_t mix=(crc^inbyte)&0x01;
+      crc>>=1;
+      if(mix) crc^=0x8C;
+      inbyte>>=1;
+    }
+  }
+  return crc;
+}
+
+/*
+** ethernet, the W5100 has MAX_SOCK_NUM sockets for everyone to
+** share. Tcp sockets connect to the simulated server, which
+** answers a request as soon as its first line has been sent.
+** Nothing blocks in here, a connect or a close takes time by
+** changing the socket status later.
+*/
+
+typedef struct {
+  uint8_t sr;			// SnSR
+  uint64_t at;			// sim_now a connect in progress is decided
+  bool refused;			// and it fails then
+  bool counted;			// request not accounted for yet
+  std::string request;
+  std::string response;
+  size_t pos;
+  uint64_t ready;		// sim_now when the response started
+  unsigned long byte_time;
+  bool endless;
+  bool hang;
+  bool whole;			// the server sends all of a 200 or 204 response
+} SimSocket;
+
+static SimSocket sockets[MAX_SOCK_NUM];
+
+/*
+** bytes of the response, and filler after it, that are in
+** the receive buffer by now
+*/
+static size_t arrived(SimSocket *s) {
+  size_t n=s->response.size();
+
+  if(!s->ready || s->hang) return 0;
+  if(s->byte_time) {
+    uint64_t sent=(sim_now-s->ready)/s->byte_time;
+    if(s->endless || (sent<n)) n=sent;
+  } else if(s->endless) {
+    n=s->pos+1;
+  }
+  return n;
+}
+
+/*
+** the server closes its end once the response is out, one that
+** got no request closes when the board closes its end first
+*/
+static bool peer_closed(SimSocket *s, bool fin) {
+  if(s->hang || s->endless) return false;
+  if(!s->ready) return fin;
+  return arrived(s)>=s->response.size();
+}
+
+/*
+** a request is completed when all of a 200 or 204 response got to
+** the board, whether it read all of it or not. Every other request
+** failed: refused, hung, dropped, cut short, trickled or answered
+** with an error.
+*/
+static void account(SimSocket *s) {
+  if(!s->counted) return;
+  s->counted=false;
+  if( s->whole && (arrived(s)>=s->response.size()) ) {
+    sim_stats.completed++;
+  } else {
+    sim_stats.failed++;
+  }
+}
+
+static void update(SimSocket *s) {
+  switch(s->sr) {
+    case SnSR::SYNSENT:
+      if(sim_now<s->at) break;
+      if(s->refused) {
+        account(s);
+        s->sr=SnSR::CLOSED;
+      } else {
+        s->sr=SnSR::ESTABLISHED;
+      }
+      break;
+
+    case SnSR::ESTABLISHED:
+      if(s->ready && peer_closed(s,false)) s->sr=SnSR::CLOSE_WAIT;
+      break;
+
+    case SnSR::FIN_WAIT:
+      if(peer_closed(s,true)) {
+        account(s);
+        s->sr=SnSR::CLOSED;
+      }
+      break;
+  }
+}
+
+/*
+** the response is ready as soon as the request line is complete,
+** the faults in effect then apply to the whole connection
+*/
+static void respond(SimSocket *s) {
+  std::string body;
+  char status[32];
+  int code=200;
+  const std::string &request=s->request;
+
+  if(request.find("/loop.php")!=std::string::npos) {
+    code=sim_server.loop_status;
+  } else if(request.find("action=gethash")!=std::string::npos) {
+    if(sim_server.revocations.empty()) {
+      body="REV0";
+    } else {
+      body="REV1"+sim_server.revocations.front();
+      sim_server.revocations.pop_front();
+    }
+  } else if(request.find("/time.php")!=std::string::npos) {
+    size_t nonce=request.find("nonce=");
+    if(sim_server.clock && sim_server.time_body && (nonce!=std::string::npos)) {
+      unsigned long seconds=(sim_server.week_offset+sim_now/1000000)%604800;
+      body=sim_server.time_body(strtoul(request.c_str()+nonce+6,NULL,10),seconds);
+    }
+  } else if(request.find("/keys.php")!=std::string::npos) {
+    size_t since=request.find("since=");
+    if( (since!=std::string::npos) && (strtoul(request.c_str()+since+6,NULL,10)<sim_server.keys_version) ) {
+      body=sim_server.keys;
+    }
+  }
+
+  if(sim_server.status) code=sim_server.status;
+  s->whole=(code==200) || (code==204);
+  if(!s->whole) body="error\n";
+  if( (sim_server.partial>0) && ((size_t)sim_server.partial<body.size()) ) {
+    body.resize(sim_server.partial);
+    s->whole=false;
+  }
+  snprintf(status,sizeof(status),"HTTP/1.0 %d X\r\n\r\n",code);
+  s->response=status+body;
+  if(sim_server.drop) s->response.clear();
+
+  s->ready=sim_now;
+  s->byte_time=sim_server.byte_time;
+  s->endless=sim_server.endless;
+  s->hang=sim_server.hang;
+  if(s->hang) s->response.clear();
+  if(sim_server.drop || s->hang || s->endless) s->whole=false;
+}
+
+/*
+** a reset closes every socket
+*/
+void EthernetClass::begin(uint8_t *mac, uint8_t *ip) {
+  sim_stats.resets++;
+  sim_wedged=false;
+  for(SOCKET s=0;s<MAX_SOCK_NUM;s++) {
+    close(s);
+  }
+  W5100.setIPAddress(ip);
+}
+
+// power on defaults, 200 ms and 8 retransmissions
+W5100Class::W5100Class() {
+  _rtr=2000;
+  _rcr=8;
+  memset(_ip,0,4);
+}
+
+void W5100Class::setRetransmissionTime(uint16_t timeout) {
+  _rtr=timeout;
+}
+
+void W5100Class::setRetransmissionCount(uint8_t retry) {
+  _rcr=retry;
+}
+
+void W5100Class::setIPAddress(uint8_t *addr) {
+  memcpy(_ip,addr,4);
+}
+
+void W5100Class::getIPAddress(uint8_t *addr) {
+  sim_advance(COST_W5100_POLL);
+  if(sim_wedged) memset(addr,0,4);
+  else memcpy(addr,_ip,4);
+}
+
+/*
+** ms until a connect gives up, the retransmission timeout
+** doubles after each try up to the 16 bit register limit
+*/
+unsigned long W5100Class::connectTimeout(void) {
+  unsigned long total=0;
+  unsigned long rtr=_rtr;
+
+  for(int i=0;i<=_rcr;i++) {
+    total+=rtr;
+    rtr=(rtr*2>0xffff)?0xffff:rtr*2;
+  }
+  return total/10;
+}
+
+uint8_t W5100Class::readSnSR(SOCKET s) {
+  sim_advance(COST_W5100_POLL);
+  if(sim_wedged) return 0;
+  update(&sockets[s]);
+  return sockets[s].sr;
+}
+
+uint16_t W5100Class::getRXReceivedSize(SOCKET s) {
+  SimSocket *so=&sockets[s];
+
+  sim_advance(COST_W5100_POLL);
+  if(sim_wedged || (so->sr==SnSR::CLOSED) || (so->sr==SnSR::UDP)) return 0;
+  return arrived(so)-so->pos;
+}
+
+/*
+** data goes into the transmit buffer, a send command sends it
+*/
+void W5100Class::send_data_processing(SOCKET s, uint8_t *data, uint16_t len) {
+  sim_advance(COST_W5100_POLL);
+  if(sim_wedged) return;
+  sockets[s].request.append((const char*)data,len);
+}
+
+void W5100Class::execCmdSn(SOCKET s, SockCMD cmd) {
+  SimSocket *so=&sockets[s];
+
+  sim_advance(COST_W5100_POLL);
+  if(sim_wedged) return;
+  if( (cmd==Sock_SEND) && (so->sr==SnSR::ESTABLISHED) && !so->ready &&
+      (so->request.find('\n')!=std::string::npos) ) {
+    respond(so);
+  }
+}
+
+uint8_t socket(SOCKET s, uint8_t protocol, uint16_t port, uint8_t flag) {
+  close(s);
+  if(!sim_wedged) sockets[s].sr=(protocol==SnMR::UDP)?SnSR::UDP:SnSR::INIT;
+  return 1;
+}
+
+void close(SOCKET s) {
+  SimSocket *so=&sockets[s];
+
+  sim_advance(COST_W5100_POLL);
+  if(sim_wedged) return;
+  account(so);
+  so->sr=SnSR::CLOSED;
+  so->request.clear();
+  so->response.clear();
+  so->pos=0;
+  so->ready=0;
+  so->hang=so->endless=false;
+}
+
+/*
+** the connect is decided after the server's latency, or
+** after all retransmissions when the server is down
+*/
+uint8_t connect(SOCKET s, uint8_t *addr, uint16_t port) {
+  SimSocket *so=&sockets[s];
+  unsigned long ms=sim_server.up?sim_server.latency:W5100.connectTimeout();
+
+  sim_advance(COST_W5100_POLL);
+  if(sim_wedged || (so->sr!=SnSR::INIT)) return 1;
+  sim_stats.requests++;
+  so->counted=true;
+  so->whole=false;
+  so->refused=!sim_server.up;
+  so->at=sim_now+(uint64_t)ms*1000;
+  so->sr=SnSR::SYNSENT;
+  return 1;
+}
+
+void disconnect(SOCKET s) {
+  SimSocket *so=&sockets[s];
+
+  sim_advance(COST_W5100_POLL);
+  if(sim_wedged) return;
+  update(so);
+  if(so->sr==SnSR::ESTABLISHED) {
+    so->sr=SnSR::FIN_WAIT;
+    update(so);
+  } else if(so->sr==SnSR::CLOSE_WAIT) {
+    account(so);
+    so->sr=SnSR::CLOSED;
+  }
+}
+
+uint8_t listen(SOCKET s) {
+  if(sim_wedged || (sockets[s].sr!=SnSR::INIT)) return 0;
+  sockets[s].sr=SnSR::LISTEN;
+  return 1;
+}
+
+uint16_t recv(SOCKET s, uint8_t *buf, uint16_t len) {
+  SimSocket *so=&sockets[s];
+  size_t n=arrived(so);
+  uint16_t i;
+
+  sim_advance(COST_W5100_POLL);
+  if(sim_wedged) return 0;
+  for(i=0;(i<len) && (so->pos<n);i++) {
+    buf[i]=(so->pos<so->response.size())?so->response[so->pos]:'x';
+    so->pos++;
+  }
+  return i;
+}
+
+Server::Server(uint16_t port) {
+  _port=port;
+}
+
+void Server::begin(void) {
+  for(SOCKET s=0;s<MAX_SOCK_NUM;s++) {
+    if(W5100.readSnSR(s)==SnSR::CLOSED) {
+      socket(s,SnMR::TCP,_port,0);
+      listen(s);
+      break;
+    }
+  }
+}
+
+HTTPClient::HTTPClient(char *host, uint8_t *ip) {
+  _code=0;
+}
+
+/*
+** blocks until the status line is in, like the library
+*/
+FILE *HTTPClient::getURI(char *uri) {
+  sim_stats.requests++;
+  if(!sim_server.up) {
+    sim_stats.failed++;
+    sim_advance((uint64_t)W5100.connectTimeout()*1000);
+    _code=0;
+    return NULL;
+  }
+  sim_advance((uint64_t)sim_server.latency*1000);
+  if(sim_server.hang || sim_server.endless || sim_server.drop) {
+    if(!sim_server.drop) sim_advance((uint64_t)HTTPCLIENT_TIMEOUT*1000);
+    sim_stats.failed++;
+    _code=0;
+    return NULL;
+  }
+  sim_advance((uint64_t)sim_server.byte_time*12);
+  sim_stats.completed++;
+  _code=sim_server.status?sim_server.status:sim_server.loop_status;
+  return stdin;
+}
+
+int HTTPClient::getLastReturnCode(void) {
+  return _code;
+}
+
+int HTTPClient::closeStream(FILE *stream) {
+  return 0;
+}
+
+/*
+** udp takes the first free socket, datagrams from the server
+** wait in sim_datagrams until it is open. After a reset it
+** has to be opened again.
+*/
+
+void UdpClass::begin(uint16_t port) {
+  _port=port;
+  for(_sock=0;_sock<MAX_SOCK_NUM;_sock++) {
+    if(W5100.readSnSR(_sock)==SnSR::CLOSED) break;
+  }
+  if(_sock<MAX_SOCK_NUM) socket(_sock,SnMR::UDP,port,0);
+}
+
+bool UdpClass::_open(void) {
+  return (_sock<MAX_SOCK_NUM) && (W5100.readSnSR(_sock)==SnSR::UDP);
+}
+
+// the W5100 counts its 8 byte udp header as received data
+int UdpClass::available(void) {
+  if(!_open() || sim_datagrams.empty()) return 0;
+  return sim_datagrams.front().data.size()+8;
+}
+
+uint16_t UdpClass::sendPacket(uint8_t *buf, uint16_t len, uint8_t *ip, uint16_t port) {
+  sim_stats.requests++;
+  if(!_open()) {
+    sim_stats.udp_lost++;
+    return 0;
+  }
+  return len;
+}
+
+int UdpClass::readPacket(uint8_t *buf, uint16_t len, uint8_t *ip, uint16_t *port) {
+  SimDatagram *d;
+  int n;
+
+  if(!_open() || sim_datagrams.empty()) return 0;
+  d=&sim_datagrams.front();
+  n=d->data.size();
+  memcpy(buf,d->data.data(),(n<len)?n:len);
+  memcpy(ip,d->ip,4);
+  *port=d->port;
+  sim_datagrams.pop_front();
+  return n;
+}
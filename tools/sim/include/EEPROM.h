@@ -0,0 +1,24 @@
+/*
+** Doorduino host simulator, eeprom shim
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+*/
+
+#ifndef EEPROM_h
+#define EEPROM_h
+
+#include <stdint.h>
+
+#ifndef E2END
+#define E2END 0x3FF	// atmega328
+#endif
+
+class EEPROMClass {
+  public:
+    uint8_t read(int address);
+    void write(int address, uint8_t value);
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
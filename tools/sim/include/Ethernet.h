@@ -0,0 +1,32 @@
+/*
+** Doorduino host simulator, ethernet shim
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+**
+** Server works on the simulated W5100 sockets the way the
+** arduino-0022 library does. The Doorduino libraries use the
+** sockets directly instead of Client, which waits for them.
+*/
+
+#ifndef Ethernet_h
+#define Ethernet_h
+
+#include "WProgram.h"
+#include "utility/w5100.h"
+
+class EthernetClass {
+  public:
+    void begin(uint8_t *mac, uint8_t *ip);
+};
+
+extern EthernetClass Ethernet;
+
+class Server {
+  public:
+    Server(uint16_t port);
+    void begin(void);
+  private:
+    uint16_t _port;
+};
+
+#endif
@@ -0,0 +1,23 @@
+/*
+** Doorduino host simulator, HTTPClient shim
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+*/
+
+#ifndef HTTPClient_h
+#define HTTPClient_h
+
+#include <stdio.h>
+#include "WProgram.h"
+
+class HTTPClient {
+  public:
+    HTTPClient(char *host, uint8_t *ip);
+    FILE *getURI(char *uri);
+    int getLastReturnCode(void);
+    int closeStream(FILE *stream);
+  private:
+    int _code;
+};
+
+#endif
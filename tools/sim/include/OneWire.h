@@ -0,0 +1,26 @@
+/*
+** Doorduino host simulator, onewire shim
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+**
+** Models a bus with at most one iButton touching it, the
+** search alternates between finding it and reporting the
+** end of the search like the real library does.
+*/
+
+#ifndef OneWire_h
+#define OneWire_h
+
+#include <stdint.h>
+
+class OneWire {
+  public:
+    OneWire(uint8_t pin);
+    uint8_t search(uint8_t *addr);
+    void reset_search(void);
+    static uint8_t crc8(uint8_t *addr, uint8_t len);
+  private:
+    bool _last_device;
+};
+
+#endif
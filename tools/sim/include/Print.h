@@ -0,0 +1,46 @@
+/*
+** Doorduino host simulator, Print shim (arduino-0022 api)
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+*/
+
+#ifndef Print_h
+#define Print_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+#define BYTE 0
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual void write(uint8_t c) = 0;
+    virtual void write(const char *s);
+    virtual void write(const uint8_t *buf, size_t size);
+
+    void print(const char s[]);
+    void print(char c, int base = BYTE);
+    void print(unsigned char b, int base = BYTE);
+    void print(int n, int base = DEC);
+    void print(unsigned int n, int base = DEC);
+    void print(long n, int base = DEC);
+    void print(unsigned long n, int base = DEC);
+
+    void println(const char s[]);
+    void println(char c, int base = BYTE);
+    void println(unsigned char b, int base = BYTE);
+    void println(int n, int base = DEC);
+    void println(unsigned int n, int base = DEC);
+    void println(long n, int base = DEC);
+    void println(unsigned long n, int base = DEC);
+    void println(void);
+  private:
+    void printNumber(unsigned long n, uint8_t base);
+};
+
+#endif
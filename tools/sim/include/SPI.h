@@ -0,0 +1,10 @@
+/*
+** Doorduino host simulator, spi shim
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+*/
+
+#ifndef SPI_h
+#define SPI_h
+
+#endif
@@ -0,0 +1,26 @@
+/*
+** Doorduino host simulator, udp shim
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+*/
+
+#ifndef Udp_h
+#define Udp_h
+
+#include <stdint.h>
+
+class UdpClass {
+  public:
+    void begin(uint16_t port);
+    int available(void);
+    uint16_t sendPacket(uint8_t *buf, uint16_t len, uint8_t *ip, uint16_t port);
+    int readPacket(uint8_t *buf, uint16_t len, uint8_t *ip, uint16_t *port);
+  private:
+    bool _open(void);
+    uint8_t _sock;
+    uint16_t _port;
+};
+
+extern UdpClass Udp;
+
+#endif
@@ -0,0 +1,77 @@
+/*
+** Doorduino host simulator, arduino core shim
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+**
+** Just enough of the arduino-0022 core for the Doorduino
+** libraries and sketch to compile on the host. Time is
+** virtual, see sim.h.
+*/
+
+#ifndef WProgram_h
+#define WProgram_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <avr/pgmspace.h>
+#include "Print.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+#define _BV(bit) (1<<(bit))
+
+// status and mcu registers, interrupts only happen in sleep_cpu()
+extern uint8_t SREG;
+extern uint8_t MCUSR;
+#define WDRF 3
+#define cli()
+#define sei()
+
+// watchdog and pin change interrupt registers
+extern uint8_t WDTCSR;
+extern uint8_t PCICR;
+extern uint8_t PCIFR;
+extern uint8_t PCMSK0;
+extern uint8_t PCMSK1;
+extern uint8_t PCMSK2;
+#define WDP0 0
+#define WDP1 1
+#define WDP2 2
+#define WDE 3
+#define WDCE 4
+#define WDP3 5
+#define WDIE 6
+#define PCIE0 0
+#define PCIE1 1
+#define PCIE2 2
+#define PCIF0 0
+#define PCIF1 1
+#define PCIF2 2
+
+class HardwareSerial : public Print {
+  public:
+    void begin(long baud);
+    void write(uint8_t c);
+    using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+#endif
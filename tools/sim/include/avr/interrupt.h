@@ -0,0 +1,20 @@
+/*
+** Doorduino host simulator, interrupt shim
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+**
+** Interrupt handlers become plain functions that the shims
+** call when the simulated hardware would raise them.
+*/
+
+#ifndef SIM_INTERRUPT_H
+#define SIM_INTERRUPT_H
+
+#define ISR(vector) extern "C" void vector(void)
+
+extern "C" void WDT_vect(void);
+extern "C" void PCINT0_vect(void);
+extern "C" void PCINT1_vect(void);
+extern "C" void PCINT2_vect(void);
+
+#endif
@@ -0,0 +1,25 @@
+/*
+** Doorduino host simulator, flash access shim
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+*/
+
+#ifndef SIM_PGMSPACE_H
+#define SIM_PGMSPACE_H
+
+#include <string.h>
+#include <stdint.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+typedef char prog_char;
+typedef unsigned char prog_uchar;
+#define PGM_P const prog_char *
+
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define memcpy_P memcpy
+#define strncmp_P strncmp
+
+#endif
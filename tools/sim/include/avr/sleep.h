@@ -0,0 +1,22 @@
+/*
+** Doorduino host simulator, sleep mode shim
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+**
+** sleep_cpu() moves the virtual clock on to the next pin
+** change or watchdog interrupt, see hal.cpp
+*/
+
+#ifndef SIM_SLEEP_H
+#define SIM_SLEEP_H
+
+#define SLEEP_MODE_IDLE		0
+#define SLEEP_MODE_PWR_DOWN	2
+
+#define set_sleep_mode(mode)
+#define sleep_enable()
+#define sleep_disable()
+
+void sleep_cpu(void);
+
+#endif
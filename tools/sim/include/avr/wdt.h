@@ -0,0 +1,17 @@
+/*
+** Doorduino host simulator, watchdog shim
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+*/
+
+#ifndef SIM_WDT_H
+#define SIM_WDT_H
+
+#define WDTO_15MS 0
+#define WDTO_2S 7
+
+void wdt_enable(int timeout);
+void wdt_reset(void);
+void wdt_disable(void);
+
+#endif
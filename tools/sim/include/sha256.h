@@ -0,0 +1,39 @@
+/*
+** Doorduino host simulator, Cryptosuite sha256 shim
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+*/
+
+#ifndef Sha256_h
+#define Sha256_h
+
+#include <stdint.h>
+#include "Print.h"
+
+#define HASH_LENGTH 32
+#define BLOCK_LENGTH 64
+
+class Sha256Class : public Print {
+  public:
+    void init(void);
+    void initHmac(const uint8_t *secret, int secretLength);
+    uint8_t *result(void);
+    uint8_t *resultHmac(void);
+    void write(uint8_t c);
+    using Print::write;
+  private:
+    void pad(void);
+    void addUncounted(uint8_t data);
+    void hashBlock(void);
+    uint32_t _state[8];
+    uint8_t _buffer[BLOCK_LENGTH];
+    uint8_t _offset;
+    uint32_t _byteCount;
+    uint8_t _keyBuffer[BLOCK_LENGTH];
+    uint8_t _innerHash[HASH_LENGTH];
+    uint8_t _result[HASH_LENGTH];
+};
+
+extern Sha256Class Sha256;
+
+#endif
@@ -0,0 +1,23 @@
+/*
+** Doorduino host simulator, W5100 socket shim
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+**
+** Socket calls of the arduino-0022 ethernet library. Like the
+** library, connect() and disconnect() only issue the command,
+** the socket status says when it is done.
+*/
+
+#ifndef _SOCKET_H_
+#define _SOCKET_H_
+
+#include "utility/w5100.h"
+
+uint8_t socket(SOCKET s, uint8_t protocol, uint16_t port, uint8_t flag);
+void close(SOCKET s);
+uint8_t connect(SOCKET s, uint8_t *addr, uint16_t port);
+void disconnect(SOCKET s);
+uint8_t listen(SOCKET s);
+uint16_t recv(SOCKET s, uint8_t *buf, uint16_t len);
+
+#endif
@@ -0,0 +1,71 @@
+/*
+** Doorduino host simulator, W5100 shim
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+**
+** The socket registers and commands the Doorduino libraries use,
+** with the same names as the arduino-0022 library. Tcp sockets
+** talk to the simulated server in sim.h, the retransmission
+** settings decide how long a connect to a server that is down
+** takes to fail.
+*/
+
+#ifndef W5100_H_INCLUDED
+#define W5100_H_INCLUDED
+
+#include "WProgram.h"
+
+#define MAX_SOCK_NUM 4
+
+typedef uint8_t SOCKET;
+
+class SnMR {
+  public:
+    static const uint8_t CLOSE = 0x00;
+    static const uint8_t TCP   = 0x01;
+    static const uint8_t UDP   = 0x02;
+};
+
+enum SockCMD {
+  Sock_OPEN      = 0x01,
+  Sock_LISTEN    = 0x02,
+  Sock_CONNECT   = 0x04,
+  Sock_DISCON    = 0x08,
+  Sock_CLOSE     = 0x10,
+  Sock_SEND      = 0x20,
+  Sock_RECV      = 0x40
+};
+
+class SnSR {
+  public:
+    static const uint8_t CLOSED      = 0x00;
+    static const uint8_t INIT        = 0x13;
+    static const uint8_t LISTEN      = 0x14;
+    static const uint8_t SYNSENT     = 0x15;
+    static const uint8_t ESTABLISHED = 0x17;
+    static const uint8_t FIN_WAIT    = 0x18;
+    static const uint8_t CLOSE_WAIT  = 0x1C;
+    static const uint8_t UDP         = 0x22;
+};
+
+class W5100Class {
+  public:
+    W5100Class();
+    void setRetransmissionTime(uint16_t timeout);
+    void setRetransmissionCount(uint8_t retry);
+    void setIPAddress(uint8_t *addr);
+    void getIPAddress(uint8_t *addr);
+    uint8_t readSnSR(SOCKET s);
+    uint16_t getRXReceivedSize(SOCKET s);
+    void send_data_processing(SOCKET s, uint8_t *data, uint16_t len);
+    void execCmdSn(SOCKET s, SockCMD cmd);
+    unsigned long connectTimeout(void);
+  private:
+    uint16_t _rtr;
+    uint8_t _rcr;
+    uint8_t _ip[4];
+};
+
+extern W5100Class W5100;
+
+#endif
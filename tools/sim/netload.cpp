@@ -0,0 +1,325 @@
+/*
+** Doorduino host simulator
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+**
+** Load test for the network side of the board. The simulated
+** server in sim.h stands in for the log, key, audit and time
+** servers and is made slow or hostile from a script, while the
+** sketch runs with every component its scheduler has. On top of
+** what the sketch does by itself, keys are logged, the space loop
+** is checked and revocations are polled at a steady rate. Reports,
+** per phase of the script, how long each tick worked, how many
+** requests per minute completed or failed and how often the
+** W5100 had to be reset. A request completes when all of a 200 or
+** 204 response got to the board, anything else counts as failed.
+** Fails when a tick blocks for longer than the watchdog period,
+** the board would have been reset.
+**
+**   netload [-v] [-k s] [-l s] [-r s] script.load [more.load ..]
+**
+**   -v    print every tick that overruns
+**   -k s  log a key every s seconds (default 2)
+**   -l s  check the space loop every s seconds (default 5)
+**   -r s  poll for revocations every s seconds (default 1), the
+**         sketch itself polls every CHECK_REVOCATION
+**
+** Script lines are "<seconds> <setting> [args]", # starts a
+** comment. Every line starts a new phase:
+**
+**   0    normal             well behaved server, clears all faults
+**   0    latency <ms>       connect and time to first byte
+**   60   throttle <bytes/s> responses come in at this rate
+**   120  trickle <ms>       a byte every ms after the response, forever
+**   180  partial <n>        close after n body bytes, partial 3 sends "REV"
+**   240  drop               close right after the request
+**   300  hang               accept connections, never answer
+**   360  status <code>      http status of every response
+**   420  loop 200|204       /loop.php status
+**   480  down|up
+**   500  wedge              the W5100 loses its configuration and stops responding
+**   540  end                stop here instead of a minute after the last line
+**
+** Each script runs in its own process from a freshly booted board.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "WProgram.h"
+#include <DoorduinoComponent.h>
+#include <DoorduinoNetClient.h>
+#include "sim.h"
+
+void setup(void);
+void loop(void);
+extern DoorduinoEnvironment env;
+extern DoorduinoNetClient netclient;
+
+typedef struct {
+  uint64_t when;
+  std::string setting;
+  int line;
+} Phase;
+
+typedef struct {
+  uint64_t from;		// sim_now at the start and end of the phase
+  uint64_t to;
+  std::vector<double> busy;	// ms of work per tick
+  double late;			// ms past the end of ticks
+  unsigned long requests;
+  unsigned long completed;
+  unsigned long failed;
+  unsigned long resets;
+} PhaseStats;
+
+static bool verbose=false;
+static double key_every=2;
+static double loop_every=5;
+static double revoke_every=1;
+
+static bool parse(const char *file, std::vector<Phase> &phases, uint64_t &end) {
+  FILE *f=fopen(file,"r");
+  char line[256];
+  int lineno=0;
+
+  if(!f) {
+    perror(file);
+    return false;
+  }
+
+  end=0;
+  while(fgets(line,sizeof(line),f)) {
+    char *argv[3]={ NULL, NULL, NULL };
+    int argc=0;
+    double t;
+    Phase ph;
+
+    lineno++;
+    if(char *hash=strchr(line,'#')) *hash=0;
+    for(char *tok=strtok(line," \t\r\n");tok && argc<3;tok=strtok(NULL," \t\r\n")) {
+      argv[argc++]=tok;
+    }
+    if(argc==0) continue;
+    if( (argc<2) || (sscanf(argv[0],"%lf",&t)!=1) ) goto bad;
+
+    ph.when=(uint64_t)(t*1e6);
+    ph.line=lineno;
+    ph.setting=argv[1];
+    if(argc==3) ph.setting+=std::string(" ")+argv[2];
+
+    if(!strcmp(argv[1],"end")) {
+      end=ph.when;
+      continue;
+    }
+    if( !strcmp(argv[1],"normal") || !strcmp(argv[1],"drop") || !strcmp(argv[1],"hang") ||
+        !strcmp(argv[1],"down") || !strcmp(argv[1],"up") || !strcmp(argv[1],"wedge") ) {
+      if(argc!=2) goto bad;
+    } else if( !strcmp(argv[1],"latency") || !strcmp(argv[1],"throttle") || !strcmp(argv[1],"trickle") ||
+               !strcmp(argv[1],"partial") || !strcmp(argv[1],"status") || !strcmp(argv[1],"loop") ) {
+      if(argc!=3) goto bad;
+    } else {
+      goto bad;
+    }
+    if(!phases.empty() && (ph.when<phases.back().when)) goto bad;
+    phases.push_back(ph);
+    continue;
+
+  bad:
+    fprintf(stderr,"%s:%d: cannot parse setting\n",file,lineno);
+    fclose(f);
+    return false;
+  }
+  fclose(f);
+
+  if(phases.empty()) {
+    fprintf(stderr,"%s: no settings\n",file);
+    return false;
+  }
+  if(end==0) end=phases.back().when+60000000;
+  return true;
+}
+
+static void apply(const std::string &setting) {
+  char name[32];
+  long value=0;
+
+  sscanf(setting.c_str(),"%31s %ld",name,&value);
+  if(!strcmp(name,"normal")) {
+    sim_server.up=true;
+    sim_server.status=0;
+    sim_server.byte_time=0;
+    sim_server.endless=sim_server.hang=sim_server.drop=false;
+    sim_server.partial=0;
+  } else if(!strcmp(name,"latency")) {
+    sim_server.latency=value;
+  } else if(!strcmp(name,"throttle")) {
+    sim_server.byte_time=value?1000000/value:0;
+  } else if(!strcmp(name,"trickle")) {
+    sim_server.byte_time=value*1000;
+    sim_server.endless=true;
+  } else if(!strcmp(name,"partial")) {
+    sim_server.partial=value;
+  } else if(!strcmp(name,"drop")) {
+    sim_server.drop=true;
+  } else if(!strcmp(name,"hang")) {
+    sim_server.hang=true;
+  } else if(!strcmp(name,"status")) {
+    sim_server.status=value;
+  } else if(!strcmp(name,"loop")) {
+    sim_server.loop_status=value;
+  } else if(!strcmp(name,"down")) {
+    sim_server.up=false;
+  } else if(!strcmp(name,"up")) {
+    sim_server.up=true;
+  } else if(!strcmp(name,"wedge")) {
+    sim_wedged=true;
+  }
+}
+
+static double percentile(std::vector<double> v, double p) {
+  if(v.empty()) return 0;
+  std::sort(v.begin(),v.end());
+  return v[(size_t)(p*(v.size()-1))];
+}
+
+/*
+** phases run from the first tick at or after their time until the
+** next phase starts, a tick that blocks past that is counted in
+** the phase it started in. Requests count in the phase they end
+** in, ones still open at the end are not counted.
+*/
+static int run(const char *file) {
+  std::vector<Phase> phases;
+  std::vector<PhaseStats> stats;
+  uint64_t end;
+  const uint64_t tick=SCHED_TICK*1000;
+  byte key[8]={ 0x01, 0x00, 0x00, 0x00, 0xa1, 0x00, 0x01, 0x00 };
+
+  if(!parse(file,phases,end)) return 1;
+  stats.resize(phases.size());
+
+  setup();
+  sim_reset_stats();
+
+  unsigned long key_ticks=std::max(1L,(long)(key_every*1000/SCHED_TICK));
+  unsigned long loop_ticks=std::max(1L,(long)(loop_every*1000/SCHED_TICK));
+  unsigned long revoke_ticks=std::max(1L,(long)(revoke_every*1000/SCHED_TICK));
+  uint64_t start=sim_now;
+  uint64_t worst=0;
+  uint64_t worst_at=0;
+  size_t cur=0;
+  size_t next=0;
+  SimStats before=sim_stats;
+
+  for(unsigned long n=0;sim_now-start<end;n++) {
+    for(;next<phases.size() && phases[next].when<=sim_now-start;next++) {
+      PhaseStats *ps=&stats[cur];
+      ps->to=sim_now;
+      ps->requests=sim_stats.requests-before.requests;
+      ps->completed=sim_stats.completed-before.completed;
+      ps->failed=sim_stats.failed-before.failed;
+      ps->resets=sim_stats.resets-before.resets;
+      before=sim_stats;
+      cur=next;
+      stats[cur].from=sim_now;
+      apply(phases[next].setting);
+    }
+
+    uint64_t t0=sim_now;
+    if(n%key_ticks==0) {
+      memcpy(env.addr,key,8);
+      env.log_addr=true;
+    }
+    if(n%loop_ticks==0) netclient.check_loop();
+    if(n%revoke_ticks==0) netclient.setTimeout(0);
+    loop();
+    // the scheduler waits out what is left of the tick last
+    uint64_t busy=sim_now-t0;
+    if( (sim_delay_end==sim_now) && (sim_delay_us<=busy) ) busy-=sim_delay_us;
+
+    if(busy>worst) {
+      worst=busy;
+      worst_at=t0-start;
+    }
+    stats[cur].busy.push_back(busy/1000.0);
+    if(busy>tick) {
+      stats[cur].late+=(busy-tick)/1000.0;
+      if(verbose) printf("%12.3f blocked %.1f ms\n",(t0-start)/1e6,busy/1000.0);
+    } else {
+      sim_advance(tick-busy);
+    }
+  }
+  stats[cur].to=sim_now;
+  stats[cur].requests=sim_stats.requests-before.requests;
+  stats[cur].completed=sim_stats.completed-before.completed;
+  stats[cur].failed=sim_stats.failed-before.failed;
+  stats[cur].resets=sim_stats.resets-before.resets;
+
+  printf("script %s\n",file);
+  printf("  load           key log every %.1f s, loop check every %.1f s, revocation poll every %.1f s\n",
+         key_every,loop_every,revoke_every);
+  printf("  %7s %7s  %-16s %6s %8s %8s %6s  %9s %9s %9s %6s\n",
+         "from s","to s","setting","ticks","max ms","p95 ms","late%","req/min","done/min","fail/min","resets");
+  for(size_t i=0;i<phases.size();i++) {
+    PhaseStats *ps=&stats[i];
+    double from=(ps->from-start)/1e6;
+    double to=(ps->to-start)/1e6;
+    double minutes=(to-from)/60;
+
+    if(to<=from) continue;
+    printf("  %7.1f %7.1f  %-16s %6zu %8.1f %8.1f %6.1f  %9.1f %9.1f %9.1f %6lu\n",
+           from,to,phases[i].setting.c_str(),ps->busy.size(),
+           percentile(ps->busy,1),percentile(ps->busy,0.95),100*ps->late/((to-from)*1000),
+           ps->requests/minutes,ps->completed/minutes,ps->failed/minutes,ps->resets);
+  }
+
+  if(worst>(uint64_t)SCHED_WATCHDOG*1000) {
+    printf("  watchdog       tick at %.1f s blocked %.1f ms, longer than the %d ms watchdog\n",
+           worst_at/1e6,worst/1000.0,SCHED_WATCHDOG);
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int opt;
+  int status=0;
+
+  while((opt=getopt(argc,argv,"vk:l:r:"))!=-1) {
+    switch(opt) {
+      case 'v': verbose=true; break;
+      case 'k': key_every=atof(optarg); break;
+      case 'l': loop_every=atof(optarg); break;
+      case 'r': revoke_every=atof(optarg); break;
+      default:
+        fprintf(stderr,"usage: %s [-v] [-k s] [-l s] [-r s] script.load ..\n",argv[0]);
+        return 2;
+    }
+  }
+  if(optind>=argc) {
+    fprintf(stderr,"usage: %s [-v] [-k s] [-l s] [-r s] script.load ..\n",argv[0]);
+    return 2;
+  }
+
+  for(int i=optind;i<argc;i++) {
+    int rc;
+
+    fflush(stdout);
+    pid_t pid=fork();
+    if(pid==0) {
+      rc=run(argv[i]);
+      fflush(stdout);
+      _exit(rc);
+    }
+    waitpid(pid,&rc,0);
+    if(!WIFEXITED(rc) || WEXITSTATUS(rc)) status=1;
+  }
+  return status;
+}
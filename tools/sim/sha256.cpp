@@ -0,0 +1,123 @@
+/*
+** Doorduino host simulator, sha256 and hmac-sha256
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+**
+** Same interface as Cryptosuite's Sha256, each compressed
+** block is charged to the virtual clock.
+*/
+
+#include <string.h>
+#include "sha256.h"
+#include "sim.h"
+
+#define HMAC_IPAD 0x36
+#define HMAC_OPAD 0x5c
+
+Sha256Class Sha256;
+
+static const uint32_t k[64] = {
+  0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
+  0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
+  0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
+  0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
+  0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
+  0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
+  0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
+  0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2
+};
+
+static const uint32_t init_state[8] = {
+  0x6a09e667,0xbb67ae85,0x3c6ef372,0xa54ff53a,0x510e527f,0x9b05688c,0x1f83d9ab,0x5be0cd19
+};
+
+static uint32_t ror32(uint32_t x, int n) {
+  return (x>>n)|(x<<(32-n));
+}
+
+void Sha256Class::init(void) {
+  memcpy(_state,init_state,sizeof(_state));
+  _offset=0;
+  _byteCount=0;
+}
+
+void Sha256Class::hashBlock(void) {
+  uint32_t w[64];
+  uint32_t a,b,c,d,e,f,g,h;
+
+  sim_stats.sha_blocks++;
+  sim_advance(COST_SHA256_BLOCK);
+
+  for(int i=0;i<16;i++) {
+    w[i]=((uint32_t)_buffer[i*4]<<24)|((uint32_t)_buffer[i*4+1]<<16)|
+         ((uint32_t)_buffer[i*4+2]<<8)|_buffer[i*4+3];
+  }
+  for(int i=16;i<64;i++) {
+    uint32_t s0=ror32(w[i-15],7)^ror32(w[i-15],18)^(w[i-15]>>3);
+    uint32_t s1=ror32(w[i-2],17)^ror32(w[i-2],19)^(w[i-2]>>10);
+    w[i]=w[i-16]+s0+w[i-7]+s1;
+  }
+
+  a=_state[0]; b=_state[1]; c=_state[2]; d=_state[3];
+  e=_state[4]; f=_state[5]; g=_state[6]; h=_state[7];
+  for(int i=0;i<64;i++) {
+    uint32_t t1=h+(ror32(e,6)^ror32(e,11)^ror32(e,25))+((e&f)^(~e&g))+k[i]+w[i];
+    uint32_t t2=(ror32(a,2)^ror32(a,13)^ror32(a,22))+((a&b)^(a&c)^(b&c));
+    h=g; g=f; f=e; e=d+t1; d=c; c=b; b=a; a=t1+t2;
+  }
+  _state[0]+=a; _state[1]+=b; _state[2]+=c; _state[3]+=d;
+  _state[4]+=e; _state[5]+=f; _state[6]+=g; _state[7]+=h;
+}
+
+void Sha256Class::addUncounted(uint8_t data) {
+  _buffer[_offset++]=data;
+  if(_offset==BLOCK_LENGTH) {
+    hashBlock();
+    _offset=0;
+  }
+}
+
+void Sha256Class::write(uint8_t data) {
+  _byteCount++;
+  addUncounted(data);
+}
+
+void Sha256Class::pad(void) {
+  uint64_t bits=(uint64_t)_byteCount*8;
+
+  addUncounted(0x80);
+  while(_offset!=56) addUncounted(0x00);
+  for(int i=7;i>=0;i--) addUncounted(bits>>(i*8));
+}
+
+uint8_t *Sha256Class::result(void) {
+  pad();
+  for(int i=0;i<8;i++) {
+    _result[i*4]=_state[i]>>24;
+    _result[i*4+1]=_state[i]>>16;
+    _result[i*4+2]=_state[i]>>8;
+    _result[i*4+3]=_state[i];
+  }
+  return _result;
+}
+
+void Sha256Class::initHmac(const uint8_t *secret, int secretLength) {
+  memset(_keyBuffer,0,BLOCK_LENGTH);
+  if(secretLength>BLOCK_LENGTH) {
+    init();
+    for(int i=0;i<secretLength;i++) write(secret[i]);
+    memcpy(_keyBuffer,result(),HASH_LENGTH);
+  } else {
+    memcpy(_keyBuffer,secret,secretLength);
+  }
+  init();
+  for(int i=0;i<BLOCK_LENGTH;i++) write(_keyBuffer[i]^HMAC_IPAD);
+}
+
+uint8_t *Sha256Class::resultHmac(void) {
+  memcpy(_innerHash,result(),HASH_LENGTH);
+  init();
+  for(int i=0;i<BLOCK_LENGTH;i++) write(_keyBuffer[i]^HMAC_OPAD);
+  for(int i=0;i<HASH_LENGTH;i++) write(_innerHash[i]);
+  return result();
+}
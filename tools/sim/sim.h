@@ -0,0 +1,106 @@
+/*
+** Doorduino host simulator
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+**
+** Shared state between the arduino shims and the simulator.
+** All time is virtual: nothing sleeps, the shims charge the
+** cost of each hardware operation to the virtual clock.
+*/
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <deque>
+#include <string>
+
+// cost model in microseconds, 16MHz atmega328 with a W5100
+#define COST_EEPROM_READ	1
+#define COST_EEPROM_WRITE	3300
+#define COST_ONEWIRE_EMPTY	1000	// reset pulse, no presence
+#define COST_ONEWIRE_SEARCH	13000	// 64 bit search with one device
+#define COST_SHA256_BLOCK	2000
+#define COST_SERIAL_BYTE	1042	// 9600 baud, 0022 serial tx blocks
+#define COST_W5100_POLL		20	// socket status or rx size over spi
+
+// assumed time the HTTPClient library waits for a status line
+#define HTTPCLIENT_TIMEOUT	30000	// ms
+
+#define SIM_PINS		20
+
+typedef struct {
+  unsigned long eeprom_reads;
+  unsigned long eeprom_writes;
+  unsigned long searches;
+  unsigned long sha_blocks;
+  unsigned long serial_bytes;
+  unsigned long requests;
+  unsigned long failed;		// everything that did not complete
+  unsigned long completed;	// all of a 200 or 204 response got to the board
+  unsigned long resets;		// Ethernet.begin(), the W5100 starts over
+  unsigned long udp_lost;	// datagrams sent without an open udp socket
+  uint64_t asleep;		// us powered down
+  unsigned long wdt_expired;	// watchdog resets the board would have had
+  uint64_t wdt_longest;		// us the armed watchdog went unfed
+} SimStats;
+
+typedef struct {
+  bool up;
+  unsigned long latency;	// ms per request
+  int loop_status;		// /loop.php return code
+  std::deque<std::string> revocations;	// raw hashes to hand out
+  std::string keys;		// signed /keys.php body
+  unsigned int keys_version;	// version in that body
+  bool clock;			// answers /time.php
+  unsigned long week_offset;	// seconds since monday at sim time 0
+  std::string (*time_body)(unsigned long nonce, unsigned long seconds);
+
+  // faults, all off when 0
+  int status;			// http status of every response
+  unsigned long byte_time;	// us per response byte
+  bool endless;			// filler follows the response, never closes
+  bool hang;			// accepts connections, never answers
+  bool drop;			// closes right after the request
+  int partial;			// closes after this many body bytes
+} SimServer;
+
+typedef struct {
+  uint8_t ip[4];
+  uint16_t port;
+  std::string data;
+} SimDatagram;
+
+extern uint64_t sim_now;
+extern uint8_t sim_pins[SIM_PINS];
+extern void (*sim_pin_hook)(uint8_t pin, uint8_t val);
+extern bool sim_ibutton;
+extern uint8_t sim_ibutton_addr[8];
+extern SimServer sim_server;
+extern SimStats sim_stats;
+
+// datagrams from the server, waiting for the board's udp socket
+extern std::deque<SimDatagram> sim_datagrams;
+
+// the W5100 stopped responding, it reads as all zeros and does
+// nothing until Ethernet.begin() after a hard reset
+extern bool sim_wedged;
+
+// called by sleep_cpu() to sleep up to us, returns the time
+// slept and sets *pin when a pin change woke the board first
+extern uint64_t (*sim_sleep_hook)(uint64_t us, int *pin);
+
+// receives what the board writes to its serial port when set
+extern FILE *sim_serial;
+
+// sim_now at the end of the last delay() and how long it was, a
+// tick that ends in one spent that long waiting, not working
+extern uint64_t sim_delay_end;
+extern uint64_t sim_delay_us;
+
+void sim_advance(uint64_t us);
+void sim_reset_stats(void);
+bool sim_wakes_on(uint8_t pin);
+
+#endif
@@ -0,0 +1,151 @@
+/*
+** Doorduino key store benchmark
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+**
+** Measures eeprom reads, writes and time per DoorduinoStore
+** operation at increasing store fill. Time is given both as
+** modelled avr time (see the cost model in sim.h) and as host
+** time, the former is what matters at the door.
+**
+**   storebench [-r rounds] [-s seed]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <vector>
+
+#include "WProgram.h"
+#include <sha256.h>
+#include <DoorduinoStore.h>
+#include "sim.h"
+
+static const char secret[]="benchmark secret";
+
+typedef struct {
+  const char *name;
+  unsigned long count;
+  unsigned long reads;
+  unsigned long writes;
+  uint64_t sim_us;
+  double host_ns;
+} Result;
+
+static DoorduinoStore store;
+
+static void make_addr(unsigned int n, byte *addr) {
+  addr[0]=0x01;
+  for(int i=1;i<7;i++) addr[i]=n>>((6-i)*8);
+  addr[7]=0;
+}
+
+static double host_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec*1e9+ts.tv_nsec;
+}
+
+/*
+** run one operation and account its cost
+*/
+#define MEASURE(res,op) do { \
+  unsigned long r0=sim_stats.eeprom_reads, w0=sim_stats.eeprom_writes; \
+  uint64_t t0=sim_now; \
+  double h0=host_ns(); \
+  op; \
+  (res).host_ns+=host_ns()-h0; \
+  (res).sim_us+=sim_now-t0; \
+  (res).reads+=sim_stats.eeprom_reads-r0; \
+  (res).writes+=sim_stats.eeprom_writes-w0; \
+  (res).count++; \
+} while(0)
+
+static void print(Result *r, int fill) {
+  if(r->count==0) return;
+  printf("%4d%%  %-18s %9.1f %9.1f %12.1f %10.0f\n",fill,r->name,
+         (double)r->reads/r->count,(double)r->writes/r->count,
+         (double)r->sim_us/r->count,r->host_ns/r->count);
+}
+
+int main(int argc, char **argv) {
+  int rounds=200;
+  int opt;
+
+  srand(1);
+  while((opt=getopt(argc,argv,"r:s:"))!=-1) {
+    switch(opt) {
+      case 'r': rounds=atoi(optarg); break;
+      case 's': srand(atoi(optarg)); break;
+      default:
+        fprintf(stderr,"usage: %s [-r rounds] [-s seed]\n",argv[0]);
+        return 2;
+    }
+  }
+
+  int slots=store.capacity();
+  printf("%d slots, %d rounds per operation\n",slots,rounds);
+  printf("%5s  %-18s %9s %9s %12s %10s\n","fill","operation","reads","writes","avr us","host ns");
+
+  for(int fill=0;fill<=100;fill+=10) {
+    int keys=slots*fill/100;
+    std::vector<unsigned int> present;
+    byte addr[8], found[8];
+
+    store.erase();
+    for(int i=0;i<keys;i++) {
+      make_addr(i,addr);
+      store.add_key(addr);
+      present.push_back(i);
+    }
+
+    Result res[]={
+      { "find_key present" }, { "find_key absent" }, { "lookup cached" }, { "lookup absent" },
+      { "is_admin" }, { "add_key" }, { "add_key full" }, { "del_key" },
+      { "set_admin" }, { "reset_admin" }, { "get_key_by_hash" },
+    };
+
+    for(int round=0;round<rounds;round++) {
+      unsigned int missing=0x100000+rand();
+
+      if(!present.empty()) {
+        unsigned int hit=present[rand()%present.size()];
+        make_addr(hit,addr);
+        MEASURE(res[0],store.find_key(addr));
+        store.lookup(addr);
+        MEASURE(res[2],store.lookup(addr));
+        MEASURE(res[4],store.is_admin(addr));
+        MEASURE(res[8],store.set_admin(addr));
+        MEASURE(res[9],store.reset_admin(addr));
+
+        // del_key and put it back, the slot it returns to may differ
+        MEASURE(res[7],store.del_key(addr));
+        store.add_key(addr);
+
+        if(round%10==0) {
+          Sha256.init();
+          Sha256.print(secret);
+          for(int i=0;i<8;i++) Sha256.print(addr[i]);
+          uint8_t hash[32];
+          memcpy(hash,Sha256.result(),32);
+          MEASURE(res[10],store.get_key_by_hash(hash,secret,found));
+        }
+      }
+
+      make_addr(missing,addr);
+      MEASURE(res[1],store.find_key(addr));
+      MEASURE(res[3],store.lookup(addr));
+      if(keys<slots) {
+        MEASURE(res[5],store.add_key(addr));
+        store.del_key(addr);
+      } else {
+        MEASURE(res[6],store.add_key(addr));
+      }
+    }
+
+    for(size_t i=0;i<sizeof(res)/sizeof(res[0]);i++) print(&res[i],fill);
+  }
+  return 0;
+}
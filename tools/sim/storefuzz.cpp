@@ -0,0 +1,308 @@
+/*
+** Doorduino key store differential fuzzer
+** (c) 2011, "Koen Martens" <gmc@revspace.nl>
+** Released under LGPL3
+**
+** Runs random operations against DoorduinoStore and a plain
+** in-memory model of what the store should do, and stops at
+** the first disagreement. The address pool is larger than the
+** store so it fills up, overflows and drains again. Now and
+** then a key list sync is staged in the inactive bank, the
+** active bank must not change until it is committed. Outside
+** a sync nothing but the slots of the active bank may change,
+** the inactive bank, the versions, the selector and what the
+** store leaves to the audit log are compared byte for byte.
+** Before that an eeprom of the old layout is converted, or left
+** alone when its keys do not fit.
+**
+**   storefuzz [-n ops] [-s seed] [-p pool]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <map>
+
+#include "WProgram.h"
+#include <EEPROM.h>
+#include <sha256.h>
+#include <DoorduinoStore.h>
+#include "sim.h"
+
+static const char secret[]="fuzz secret";
+
+typedef std::map<unsigned int,bool> Model;	// key -> admin
+
+static DoorduinoStore store;
+static Model model;
+static uint16_t model_version;
+static byte saved[E2END+1];	// eeprom as it must stay outside the active slots
+static int slots;
+static unsigned long op;
+static unsigned int pool;
+
+static void make_addr(unsigned int n, byte *addr) {
+  addr[0]=0x01;
+  for(int i=1;i<7;i++) addr[i]=n>>((6-i)*8);
+  addr[7]=0x5a;
+}
+
+static void fail(const char *what, unsigned int key, long got, long want) {
+  fprintf(stderr,"op %lu: %s(key %u) returned %ld, model says %ld\n",op,what,key,got,want);
+  exit(1);
+}
+
+#define EXPECT(what,key,got,want) do { long g=(got), w=(want); if(g!=w) fail(what,key,g,w); } while(0)
+
+static int active_bank(void) {
+  return (EEPROM.read(STORE_SELECT)&1)*STORE_BANK_SIZE;
+}
+
+static void save_eeprom(void) {
+  for(int i=0;i<=E2END;i++) saved[i]=EEPROM.read(i);
+}
+
+/*
+** the eeprom must be as saved, except for the slots of the
+** bank at offset skip
+*/
+static void check_saved(const char *what, int skip) {
+  for(int i=0;i<=E2END;i++) {
+    if( (i>=skip) && (i<skip+STORE_VERSION) ) continue;
+    EXPECT(what,i,EEPROM.read(i),saved[i]);
+  }
+}
+
+/*
+** every key in the model must be in exactly one slot with
+** its flags, free slots must be KEY_EMPTY and nothing else
+** in the eeprom may have changed since it was saved
+*/
+static void check_eeprom(void) {
+  int used=0;
+  byte addr[8];
+
+  EXPECT("selector",0,EEPROM.read(STORE_SELECT),EEPROM.read(STORE_SELECT)&1);
+  EXPECT("version",0,store.version(),model_version);
+  for(int idx=0;idx<slots;idx++) {
+    byte flags=store.get_slot(idx,addr);
+
+    if(!(flags&KEY_INUSE)) {
+      EXPECT("free slot",idx,flags,KEY_EMPTY);
+      continue;
+    }
+    used++;
+  }
+  EXPECT("slots in use",0,used,model.size());
+
+  for(Model::iterator m=model.begin();m!=model.end();m++) {
+    int idx;
+
+    make_addr(m->first,addr);
+    idx=store.find_slot(addr);
+    EXPECT("find_slot",m->first,idx!=-1,true);
+    EXPECT("slot flags",m->first,store.get_slot(idx,addr),KEY_INUSE|(m->second?KEY_ADMIN:0));
+  }
+
+  check_saved("byte outside the active slots",active_bank());
+}
+
+/*
+** fill what the store does not own with a pattern, a stray
+** write of 0 shows up as well
+*/
+static void erase(void) {
+  store.erase();
+  for(int i=STORE_FREE;i<STORE_SELECT;i++) {
+    if(i!=STORE_LAYOUT) EEPROM.write(i,(i*7)|1);
+  }
+  model.clear();
+  model_version=0;
+  save_eeprom();
+}
+
+/*
+** copy, change and commit the inactive bank like a key list
+** sync does, checking lookups against the old model meanwhile
+*/
+static void stage_sync(void) {
+  Model next=model;
+  uint16_t version=store.version();
+  int changes=rand()%8;
+
+  save_eeprom();
+  for(int idx=0;idx<slots;idx++) store.stage_copy(idx);
+
+  for(int n=0;n<changes;n++) {
+    unsigned int key=rand()%pool;
+    bool staged=next.count(key);
+    byte addr[8];
+
+    make_addr(key,addr);
+    if(rand()%2) {
+      bool admin=rand()%2;
+      bool want=staged || ((int)next.size()<slots);
+      EXPECT("stage_add",key,store.stage_add(addr,KEY_INUSE|(admin?KEY_ADMIN:0)),want);
+      if(want) next[key]=admin;
+    } else {
+      EXPECT("stage_del",key,store.stage_del(addr),staged);
+      next.erase(key);
+    }
+    EXPECT("find_key while staging",key,store.find_key(addr)!=-1,model.count(key));
+  }
+
+  check_saved("byte outside the inactive slots while staging",STORE_BANK_SIZE-active_bank());
+
+  store.stage_commit(version+1);
+  EXPECT("version",0,store.version(),version+1);
+  model=next;
+  model_version=version+1;
+  save_eeprom();
+}
+
+/*
+** an eeprom of the old layout with keys in its first slots,
+** the rest as the old firmware left it
+*/
+static void old_layout(int keys) {
+  byte addr[8];
+
+  for(int i=0;i<=E2END;i++) EEPROM.write(i,0xff);
+  for(int idx=0;idx<STORE_OLD_SLOTS;idx++) {
+    make_addr(idx,addr);
+    EEPROM.write(idx*STORE_SLOT_SIZE,(idx<keys)?KEY_INUSE:KEY_EMPTY);
+    for(int i=0;i<8;i++) EEPROM.write(idx*STORE_SLOT_SIZE+1+i,addr[i]);
+  }
+}
+
+/*
+** keys of the old layout move when they fit in bank 0, an
+** eeprom with more is left as it is and every key is found
+*/
+static void check_migrate(void) {
+  byte addr[8];
+  int spread=STORE_OLD_SLOTS*STORE_SLOT_SIZE;
+
+  old_layout(STORE_SLOTS+1);
+  save_eeprom();
+  store.begin();
+  EXPECT("legacy",STORE_SLOTS+1,store.legacy(),true);
+  EXPECT("capacity",STORE_SLOTS+1,store.capacity(),STORE_OLD_SLOTS);
+  for(int i=0;i<spread;i++) EXPECT("old layout byte",i,EEPROM.read(i),saved[i]);
+  for(int idx=0;idx<=STORE_SLOTS;idx++) {
+    make_addr(idx,addr);
+    EXPECT("find_key in old layout",idx,store.find_key(addr),idx*STORE_SLOT_SIZE);
+  }
+
+  // with one key less they fit, the last one moves into bank 0
+  make_addr(0,addr);
+  EXPECT("del_key in old layout",0,store.del_key(addr),true);
+  store.begin();
+  EXPECT("legacy",STORE_SLOTS,store.legacy(),false);
+  EXPECT("version",STORE_SLOTS,store.version(),0);
+  for(int idx=1;idx<=STORE_SLOTS;idx++) {
+    make_addr(idx,addr);
+    EXPECT("find_key after migrating",idx,store.find_key(addr)!=-1,true);
+  }
+}
+
+int main(int argc, char **argv) {
+  unsigned long ops=1000000;
+  int opt;
+
+  srand(1);
+  while((opt=getopt(argc,argv,"n:s:p:"))!=-1) {
+    switch(opt) {
+      case 'n': ops=strtoul(optarg,NULL,10); break;
+      case 's': srand(atoi(optarg)); break;
+      case 'p': pool=atoi(optarg); break;
+      default:
+        fprintf(stderr,"usage: %s [-n ops] [-s seed] [-p pool]\n",argv[0]);
+        return 2;
+    }
+  }
+
+  check_migrate();
+  slots=store.capacity();
+  if(pool==0) pool=slots*3/2;
+  erase();
+
+  for(op=0;op<ops;op++) {
+    unsigned int key=rand()%pool;
+    Model::iterator m=model.find(key);
+    bool present=(m!=model.end());
+    byte addr[8];
+
+    make_addr(key,addr);
+
+    switch(rand()%100) {
+      case 0 ... 29:
+        EXPECT("find_key",key,store.find_key(addr)!=-1,present);
+        break;
+
+      case 30 ... 49: {
+        int base=store.lookup(addr);
+        EXPECT("lookup",key,base!=-1,present);
+        if(present) EXPECT("lookup offset",key,base,store.find_key(addr));
+        EXPECT("lookup_flags",key,store.lookup_flags(addr),present?(KEY_INUSE|(m->second?KEY_ADMIN:0)):KEY_EMPTY);
+        break;
+      }
+
+      case 50 ... 54:
+        EXPECT("check",key,store.check(addr),present);
+        EXPECT("is_admin",key,store.is_admin(addr),present && m->second);
+        break;
+
+      case 55 ... 74: {
+        bool want=present || ((int)model.size()<slots);
+        EXPECT("add_key",key,store.add_key(addr),want);
+        if(want) model[key]=false;
+        break;
+      }
+
+      case 75 ... 89:
+        EXPECT("del_key",key,store.del_key(addr),present);
+        if(present) model.erase(m);
+        break;
+
+      case 90 ... 93:
+        EXPECT("set_admin",key,store.set_admin(addr),present);
+        if(present) m->second=true;
+        break;
+
+      case 94 ... 97:
+        EXPECT("reset_admin",key,store.reset_admin(addr),present);
+        if(present) m->second=false;
+        break;
+
+      case 98: {
+        uint8_t hash[32];
+        byte found[8];
+
+        Sha256.init();
+        Sha256.print(secret);
+        for(int i=0;i<8;i++) Sha256.print(addr[i]);
+        memcpy(hash,Sha256.result(),32);
+        EXPECT("get_key_by_hash",key,store.get_key_by_hash(hash,secret,found),present);
+        if(present) EXPECT("get_key_by_hash address",key,memcmp(found,addr,8),0);
+        break;
+      }
+
+      case 99:
+        if(rand()%100==0) {
+          erase();
+        } else if(rand()%10==0) {
+          stage_sync();
+        }
+        check_eeprom();
+        break;
+    }
+  }
+
+  check_eeprom();
+  printf("%lu operations, %u keys in pool, %d slots: store matches model\n",ops,pool,slots);
+  printf("eeprom %lu reads, %lu writes, key cache %lu hits, %lu misses\n",
+         sim_stats.eeprom_reads,sim_stats.eeprom_writes,store.cache_hits(),store.cache_misses());
+  return 0;
+}
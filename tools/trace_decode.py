@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+#
+# Doorduino trace decoder
+# (c) 2011, "Koen Martens" <gmc@revspace.nl>
+# Released under LGPL3
+#
+# Turns the binary trace records written by DoorduinoTrace back into
+# readable log lines. Event ids and their format strings are read from
+# DoorduinoTrace.h, so the decoder never needs updating by hand.
+# Each record is framed by a sync byte and followed by the 8 bit sum of
+# its bytes, frames that do not add up are skipped a byte at a time:
+#
+#   trace_decode.py /dev/ttyUSB0
+#   trace_decode.py capture.bin
+#
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+SYNC = 0xa5
+RECORD = struct.Struct('<BBHI')
+HEADER = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                      '..', 'libraries', 'DoorduinoTrace', 'DoorduinoTrace.h')
+
+
+def load_events(header):
+    events = {}
+    pattern = re.compile(r'^#define\s+(TR_\w+)\s+(\d+)\s*//\s*(.*)$')
+    with open(header) as f:
+        for line in f:
+            m = pattern.match(line.strip())
+            if m:
+                events[int(m.group(2))] = (m.group(1), m.group(3))
+    return events
+
+
+def records(stream):
+    buf = bytearray()
+    while True:
+        chunk = stream.read(64)
+        if not chunk:
+            return
+        buf += chunk
+        while len(buf) >= RECORD.size + 2:
+            record = bytes(buf[1:1 + RECORD.size])
+            if buf[0] != SYNC or sum(record) & 0xff != buf[1 + RECORD.size]:
+                del buf[0]
+                continue
+            yield RECORD.unpack(record)
+            del buf[:RECORD.size + 2]
+
+
+def main():
+    ap = argparse.ArgumentParser(description='Doorduino trace decoder')
+    ap.add_argument('input', nargs='?', help='capture file or serial device, default stdin')
+    ap.add_argument('--header', default=HEADER)
+    args = ap.parse_args()
+
+    events = load_events(args.header)
+    stream = open(args.input, 'rb', buffering=0) if args.input else sys.stdin.buffer
+
+    # the board only keeps the low 16 bits of millis()
+    last = None
+    epoch = 0
+    for eid, a, time, b in records(stream):
+        if last is not None and time < last:
+            epoch += 0x10000
+        last = time
+
+        name, fmt = events.get(eid, ('TR_%d' % eid, 'a={a} b={b}'))
+        s = b - (1 << 32) if b & 0x80000000 else b
+        try:
+            text = fmt.format(a=a, b=b, s=s)
+        except (ValueError, IndexError, KeyError):
+            text = '%s a=%d b=%d' % (fmt, a, b)
+        print('%10.3f %-20s %s' % ((epoch + time) / 1000.0, name, text))
+        sys.stdout.flush()
+
+
+if __name__ == '__main__':
+    main()
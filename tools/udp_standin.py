@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+#
+# Doorduino udp stand-in server
+# (c) 2011, "Koen Martens" <gmc@revspace.nl>
+# Released under LGPL3
+#
+# Receives log batches from DoorduinoNetUdp, verifies their hmac, prints
+# the key hashes and answers with cumulative acks. State pushes can be
+# sent to the board with --push, e.g.:
+#
+#   udp_standin.py --secret2 "some other very long sentence" \
+#                  --board 10.0.6.66 --push loop=closed,space=open
+#
+# The board only takes acks and state pushes for the boot it is in, and
+# state pushes that are newer than the last one. The listener keeps the
+# boot of the last log batch of each board in --seq-file, next to the
+# sequence number of the last push. A board sends an empty batch when it
+# restarts, so the listener has to run before a push can reach it.
+#
+
+import argparse
+import hashlib
+import hmac
+import json
+import os
+import socket
+import struct
+import sys
+
+HASH_SIZE = 32
+HDR = struct.Struct('>cHBH')  # type, seq, count or flags, boot
+LOG_RESYNC = 0x80
+LOOP_CLOSED = 1
+SPACE_CLOSED = 2
+
+
+def sign(secret, payload):
+    return payload + hmac.new(secret, payload, hashlib.sha256).digest()
+
+
+def verify(secret, datagram):
+    if len(datagram) < HDR.size + HASH_SIZE:
+        return None
+    payload, tag = datagram[:-HASH_SIZE], datagram[-HASH_SIZE:]
+    if not hmac.compare_digest(hmac.new(secret, payload, hashlib.sha256).digest(), tag):
+        return None
+    return payload
+
+
+def state_flags(spec):
+    flags = 0
+    for item in spec.split(','):
+        name, _, value = item.partition('=')
+        if value == 'closed':
+            flags |= LOOP_CLOSED if name == 'loop' else SPACE_CLOSED
+    return flags
+
+
+def load_boards(path):
+    try:
+        with open(path) as f:
+            return json.load(f)
+    except (OSError, ValueError):
+        return {}
+
+
+def save_boards(path, boards):
+    with open(path + '.tmp', 'w') as f:
+        json.dump(boards, f)
+    os.replace(path + '.tmp', path)
+
+
+def next_push(path, board):
+    boards = load_boards(path)
+    state = boards.setdefault(board, {})
+    if 'boot' not in state:
+        return None, None
+    # 0 means no push yet to the board, the compare on it wraps at 16 bits
+    state['seq'] = state.get('seq', 0) % 0xffff + 1
+    save_boards(path, boards)
+    return state['seq'], state['boot']
+
+
+def seen_boot(path, board, boot):
+    boards = load_boards(path)
+    state = boards.setdefault(board, {})
+    if state.get('boot') != boot:
+        state['boot'] = boot
+        save_boards(path, boards)
+
+
+def main():
+    ap = argparse.ArgumentParser(description='Doorduino udp stand-in server')
+    ap.add_argument('--secret2', required=True)
+    ap.add_argument('--listen', default='0.0.0.0')
+    ap.add_argument('--port', type=int, default=5001)
+    ap.add_argument('--board', help='board ip, required for --push')
+    ap.add_argument('--board-port', type=int, default=5001)
+    ap.add_argument('--push', help='send state push, e.g. loop=closed,space=open')
+    ap.add_argument('--seq-file', default=os.path.expanduser('~/.udp_standin_seq'),
+                    help='boot and state push sequence number per board')
+    ap.add_argument('--drop-acks', type=int, default=0,
+                    help='do not ack the first N batches, to exercise retransmits')
+    args = ap.parse_args()
+
+    secret = args.secret2.encode()
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind((args.listen, args.port))
+
+    if args.push:
+        seq, boot = next_push(args.seq_file, args.board)
+        if seq is None:
+            print('no log batch from %s yet, its boot is not known' % args.board)
+            return 1
+        sock.sendto(sign(secret, HDR.pack(b'S', seq, state_flags(args.push), boot)),
+                    (args.board, args.board_port))
+        print('pushed state seq=%d boot=%d %s' % (seq, boot, args.push))
+        return 0
+
+    expected = None
+    dropped = 0
+    while True:
+        datagram, peer = sock.recvfrom(1024)
+        payload = verify(secret, datagram)
+        if payload is None or payload[0:1] != b'L':
+            print('%s: rejected datagram (%d bytes)' % (peer[0], len(datagram)))
+            continue
+
+        _, seq, count, boot = HDR.unpack(payload[:HDR.size])
+        resync = count & LOG_RESYNC
+        count &= ~LOG_RESYNC
+        hashes = [payload[HDR.size + i * HASH_SIZE:HDR.size + (i + 1) * HASH_SIZE] for i in range(count)]
+        seen_boot(args.seq_file, peer[0], boot)
+
+        # the board dropped events or restarted, what it no longer
+        # has will never come, carry on from this batch
+        gap = (seq - expected) & 0xffff if expected is not None else 0
+        if expected is None or resync or 0 < gap < 0x8000:
+            if expected is not None and seq != expected:
+                if 0 < gap < 0x8000:
+                    print('%s: %d events lost before seq=%d' % (peer[0], gap, seq))
+                else:
+                    print('%s: resync at seq=%d' % (peer[0], seq))
+            expected = seq
+
+        # only accept events contiguous with what we have seen,
+        # cumulative acks let the board resend the rest
+        for i, h in enumerate(hashes):
+            if (seq + i) & 0xffff == expected:
+                print('%s: seq=%d key=%s' % (peer[0], expected, h.hex()))
+                expected = (expected + 1) & 0xffff
+
+        if dropped < args.drop_acks:
+            dropped += 1
+            continue
+        sock.sendto(sign(secret, HDR.pack(b'A', (expected - 1) & 0xffff, 0, boot)), peer)
+
+
+if __name__ == '__main__':
+    sys.exit(main())